@@ -0,0 +1,14 @@
+#pragma once
+
+#include "parallel_for.h"
+
+// Dummy implementation of tbb's functional parallel_reduce:
+// Single threaded, the whole range is reduced by a single call of the body
+
+namespace tbb
+{
+	template<typename Range, typename Value, typename RealBody, typename Reduction>
+	Value parallel_reduce( const Range& range, const Value& identity, const RealBody& real_body, const Reduction& /*reduction*/ ) {
+		return real_body(range, identity);
+	}
+}
@@ -4,10 +4,13 @@
 
 #include <nanogui/screen.h>
 #include <nanogui/textbox.h>
+#include <nanogui/progressbar.h>
 
+#include <atomic>
 #include <thread>
 
 #include <tekari/bsdf_canvas.h>
+#include <tekari/catalog.h>
 #include <tekari/dataset_button.h>
 #include <tekari/metadata_window.h>
 #include <tekari/color_map_selection_window.h>
@@ -33,11 +36,23 @@ using nanogui::Slider;
 using nanogui::FloatBox;
 using nanogui::IntBox;
 using nanogui::GLFramebuffer;
+using nanogui::ProgressBar;
+
+// State shared by the previews and the final dataset of a file being loaded
+struct DatasetLoading
+{
+    std::atomic<float> progress{ 0.0f };
+    std::shared_ptr<Dataset> displayed_preview;     // only accessed from the UI thread
+    bool discarded = false;                         // the user deleted a preview (only accessed from the UI thread)
+};
 
 struct Dataset_to_add
 {
     string error_msg;
     std::shared_ptr<Dataset> dataset;
+    // previews are replaced by the next preview (or the final dataset) of the same loading
+    bool is_preview = false;
+    std::shared_ptr<DatasetLoading> loading;
 };
 
 class BSDFApplication : public Screen {
@@ -78,11 +93,14 @@ public:
     void hide_windows();
 
     void open_files(const vector<string>& dataset_paths);
+    void open_files(const Catalog& catalog, const CatalogQuery& query);
 private:
     void toggle_view(Dataset::Views view);
 
     void update_layout();
     void add_dataset(std::shared_ptr<Dataset> dataset);
+    bool add_loaded_dataset(std::shared_ptr<Dataset_to_add> new_dataset);
+    void update_loading_progress();
 
     void toggle_tool_checkbox(CheckBox* checkbox);
 
@@ -91,6 +109,8 @@ private:
     bool drop_event(const std::vector<std::string> & filenames) override;
 
     void reprint_footer();
+    // shows the albedo map of the selected dataset (at the displayed wavelength) over the incident angle slider
+    void update_albedo_overlay();
 
 private:
     bool m_requires_layout_update = false;
@@ -117,6 +137,10 @@ private:
     Label* m_dataset_points_count;
     Label* m_dataset_average_height;
 
+    // progress of the datasets being loaded
+    ProgressBar* m_loading_progress_bar;
+    vector<std::shared_ptr<DatasetLoading>> m_loadings;
+
     // dataset scroll panel
     VScrollPanel* m_datasets_scroll_panel;
     Widget* m_scroll_content;
@@ -131,6 +155,7 @@ private:
     FloatBox<float>* m_phi_float_box;
     FloatBox<float>* m_theta_float_box;
     Slider2D* m_incident_angle_slider;
+    Button* m_albedo_button;
 
     // dialog windows
     Window* m_metadata_window;
@@ -1,17 +1,38 @@
 #pragma once
 
+#include <atomic>
+#include <future>
+#include <list>
 #include <tekari/dataset.h>
+#include <tekari/dataset_cache.h>
 #include <tekari/powitacq.h>
 
 TEKARI_NAMESPACE_BEGIN
 
+// Whether the spectra of .bsdf files are kept in half precision in memory (halves their footprint)
+extern void set_bsdf_half_precision(bool half_precision);
+extern bool bsdf_half_precision();
+// Whether all the wavelengths of .bsdf files are sampled in the background as soon as their incident angle changes
+extern void set_bsdf_background_spectra(bool background_spectra);
+extern bool bsdf_background_spectra();
+// Whether the states of .bsdf files are sampled adaptively (denser where the measurement varies the most)
+extern void set_bsdf_adaptive_sampling(bool adaptive_sampling);
+extern bool bsdf_adaptive_sampling();
+
 class BSDFDataset : public Dataset
 {
 public:
 
     BSDFDataset(const string& file_path);
+    virtual ~BSDFDataset();
     virtual bool init() override;
-    void set_incident_angle(const Vector2f& incident_angle);
+    void set_incident_angle(const Vector2f& incident_angle) { set_incident_angle(incident_angle, m_n_theta, m_n_phi); }
+    // displays a coarse state right away and refines it to the sampling resolution in the background
+    // (meant for dragging the incident angle around), on_refined is called from the worker thread once
+    // the refined state is ready to be displayed by update_refinement
+    void set_incident_angle_interactive(const Vector2f& incident_angle, function<void()> on_refined);
+    // displays the refined state if it is ready (returns whether it was)
+    bool update_refinement();
     virtual void set_intensity_index(size_t displayed_wavelength) override;
     void set_sampling_resolution(size_t n_theta, size_t n_phi)
     {
@@ -24,12 +45,112 @@ public:
 
     virtual void get_selection_spectrum(vector<float> &spectrum) override;
 
+    // resamples the brdf onto a dense table of half/difference angles (see powitacq::BRDF::export_table)
+    void export_table(const string& path, const powitacq::BRDF::TableGrid& grid = powitacq::BRDF::TableGrid()) const;
+    // bsdf datasets are saved as dense RGB tables
+    virtual void save(const string& path) override { export_table(path); }
+
+    // restores the directional albedo map from its cache, or integrates it in the background (on_computed
+    // is then called from the worker thread once the map is ready to be picked up by update_albedo_map)
+    void start_computing_albedo_map(function<void()> on_computed);
+    // picks up the computed albedo map if it is ready (returns whether it was)
+    bool update_albedo_map();
+    bool computing_albedo_map() const { return m_albedo_computation.valid(); }
+    bool has_albedo_map() const { return !m_albedo_map.empty(); }
+    const AlbedoMap& albedo_map() const { return m_albedo_map; }
+
 private:
+    // incident angle (quantized to a hundredth of a degree) and sampling resolution of a state
+    struct StateKey
+    {
+        int theta = 0;
+        int phi = 0;
+        size_t n_theta = 0;     // 0 for no state
+        size_t n_phi = 0;
+
+        bool operator==(const StateKey& other) const
+        {
+            return theta == other.theta && phi == other.phi &&
+                   n_theta == other.n_theta && n_phi == other.n_phi;
+        }
+    };
+
+    // everything computed for an incident angle and sampling resolution, ready to be displayed again
+    struct CachedState
+    {
+        StateKey key;
+        powitacq::BRDF::State brdf_state;
+        RawMeasurement raw_measurement;
+        Matrix2Xf v2d;
+        Matrix3Xi f;
+        VectorXu path_segments;
+        MatrixXXf colors;
+        MatrixXXf h[2];
+        Matrix4XXf n[2];
+        Mask cache_mask;
+        PointsStats points_stats;
+        bool spectra_sampled = false;
+
+        size_t memory_size() const;
+    };
+
+    // a state refined in the background, shared with its task so that the task can be abandoned while running
+    struct Refinement
+    {
+        size_t generation;
+        Vector2f incident_angle;
+        powitacq::BRDF brdf;        // computes the state (shares the tables of m_brdf)
+        CachedState state;
+        double time = 0.0;
+        std::atomic<bool> cancelled;
+
+        Refinement(size_t generation, const Vector2f& incident_angle, const powitacq::BRDF& brdf)
+        : generation(generation), incident_angle(incident_angle), brdf(brdf), cancelled(false) {}
+    };
+
+    static StateKey state_key(const Vector2f& incident_angle, size_t n_theta, size_t n_phi);
+    void set_incident_angle(const Vector2f& incident_angle, size_t n_theta, size_t n_phi);
+    // computes everything displayed for an incident angle with the given brdf
+    // (returns false if the incident angle is invalid or the computation was cancelled)
+    static bool compute_state(powitacq::BRDF& brdf, const Vector2f& incident_angle, size_t n_theta, size_t n_phi,
+                              CachedState& state, const std::atomic<bool>& cancelled);
+    // displays a computed state (the previously displayed one is cached)
+    void display_state(CachedState&& state, const Vector2f& incident_angle);
+    // stops the background refinement (if any) without waiting for it
+    void cancel_refinement();
+
+    // exchanges the displayed state with the given one
+    void swap_state(CachedState& state);
+    // keeps a state for later (evicting the least recently used ones beyond the memory budget)
+    void cache_state(CachedState&& state);
+
     void compute_samples();
+    // fills the intensities of all the wavelengths in one pass
+    void sample_spectra();
+    // runs sample_spectra in the background
+    void start_sampling_spectra();
+    // waits for the background sampling of the wavelengths (if any)
+    void wait_for_spectra();
 
     powitacq::BRDF m_brdf;
     size_t m_n_theta;
     size_t m_n_phi;
+    powitacq::WavelengthMask m_visible_wavelengths;
+
+    bool m_spectra_sampled;                 // whether the intensities of all the wavelengths are (being) filled
+    StateKey m_state_key;                   // key of the displayed state
+    std::list<CachedState> m_state_cache;   // previously displayed states, most recently used first
+    std::future<void> m_spectra_sampling;   // background sampling of the wavelengths, waited for on destruction
+
+    powitacq::BRDF m_work_brdf;             // computes the states set right away (shares the tables of m_brdf)
+    size_t m_refinement_generation;         // incremented whenever a refinement is started or cancelled
+    std::shared_ptr<Refinement> m_refinement;
+    std::future<bool> m_refinement_task;    // background refinement, waited for on destruction
+    std::list<std::future<bool>> m_cancelled_refinements;  // still running ones, waited for on destruction
+
+    string m_file_path;
+    AlbedoMap m_albedo_map;
+    std::future<AlbedoMap> m_albedo_computation;    // waited for on destruction
 };
 
 TEKARI_NAMESPACE_END
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <tekari/common.h>
+
+TEKARI_NAMESPACE_BEGIN
+
+// Metadata of a measurement file, as stored in a catalog
+struct CatalogEntry
+{
+    string path;                // canonical path of the measurement
+    uint64_t size;              // size and modification time of the measurement when it was indexed
+    int64_t mtime;
+
+    string sample_name;
+    Vector2f incident_angle;    // theta, phi (degrees)
+    int points_in_file;
+    bool is_spectral;
+    VectorXf wavelengths;
+};
+
+struct CatalogQuery
+{
+    enum DataType { ANY = 0, STANDARD, SPECTRAL };
+
+    string sample_name;                     // substring of the sample name (empty matches every sample)
+    float theta_in = std::nanf("");         // incident angle (NaN matches every angle)
+    float phi_in = std::nanf("");
+    float angle_tolerance = 0.5f;           // degrees
+    DataType data_type = ANY;
+
+    bool matches(const CatalogEntry& entry) const;
+};
+
+// Parse a query of the form "sample=<name>,theta=<degrees>,phi=<degrees>,spectral|standard"
+// (every field is optional)
+extern CatalogQuery parse_catalog_query(const string& query);
+
+// Index of the measurements of whole directory trees, built from their metadata only
+class Catalog
+{
+public:
+    // Load a previously saved index (returns false if it doesn't exist or is invalid)
+    bool load(const string& index_path);
+    void save(const string& index_path) const;
+
+    // Index every measurement found under the given files/directories, in parallel.
+    // Entries of unchanged files are kept as is, entries of files that disappeared
+    // from the scanned directories are removed.
+    void scan(const vector<string>& roots);
+
+    vector<const CatalogEntry*> query(const CatalogQuery& query) const;
+
+    inline const vector<CatalogEntry>& entries() const { return m_entries; }
+
+private:
+    vector<CatalogEntry> m_entries;     // sorted by path
+};
+
+TEKARI_NAMESPACE_END
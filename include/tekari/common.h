@@ -291,6 +291,10 @@ inline string trim_copy(string s, function<int(int)> pred = [](int c) { return s
     return s;
 }
 
+inline bool ends_with(const string& s, const string& suffix) {
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
 inline
 std::vector<std::string> tokenize(const std::string &string,
                                   const std::string &delim,
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <tekari/common.h>
+
+TEKARI_NAMESPACE_BEGIN
+
+enum class Compression
+{
+    NONE,
+    GZIP,
+    ZSTD
+};
+
+// detect the compression of a file from its first bytes (not from its extension)
+extern Compression file_compression(const string& path);
+
+// Stream the file through the matching decompressor, appending the decompressed
+// bytes to data (no intermediate file is written). Decompression may stop early
+// once at least max_size bytes were produced.
+extern void decompress_file(const string& path, Compression compression, vector<char>& data,
+                            size_t max_size = std::numeric_limits<size_t>::max());
+
+TEKARI_NAMESPACE_END
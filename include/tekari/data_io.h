@@ -8,18 +8,63 @@
 
 TEKARI_NAMESPACE_BEGIN
 
+// Optional hooks called (from the loading thread) while a dataset is being parsed
+struct LoadingObserver
+{
+    // fraction of the file parsed so far
+    function<void(float progress)> progress;
+    // the first n_points of the measurement are parsed (angles are folded, but duplicates are not removed yet)
+    function<void(const RawMeasurement& raw_measurement, size_t n_points, const Metadata& metadata)> snapshot;
+};
+
+// Whether loading and saving datasets reports its timings on the standard output (the default)
+extern void set_dataset_io_verbose(bool verbose);
+extern bool dataset_io_verbose();
+
 extern void load_dataset(
     const string& file_name,
     RawMeasurement& raw_measurement,
     Matrix2Xf& V2D,
     VectorXf& wavelengths,
+    Metadata& metadata,
+    const LoadingObserver* observer = nullptr
+);
+
+// Only read the metadata of a dataset (leading comment lines of text files)
+extern void load_dataset_metadata(
+    const string& file_name,
+    VectorXf& wavelengths,
+    Metadata& metadata
+);
+
+// Copy at most max_points (evenly strided) of the first n_points of a measurement being loaded
+extern void copy_preview_points(
+    const RawMeasurement& raw_measurement,
+    size_t n_points,
+    size_t max_points,
+    RawMeasurement& preview
+);
+
+// Remove the duplicates of a preview and compute its 2D coordinates
+extern void finalize_preview(
+    RawMeasurement& preview,
+    Matrix2Xf& V2D,
     Metadata& metadata
 );
 
+// value type of the intensities in binary datasets
+enum class BinaryPrecision : uint32_t
+{
+    FLOAT32 = 0,
+    FLOAT16 = 1
+};
+
+// Save as text, or in a compact binary layout when the path ends with ".tkb"
 extern void save_dataset(
     const string& path,
     const RawMeasurement& raw_measurement,
-    const Metadata& metadata
+    const Metadata& metadata,
+    BinaryPrecision precision = BinaryPrecision::FLOAT32
 );
 
 TEKARI_NAMESPACE_END
\ No newline at end of file
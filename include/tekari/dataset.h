@@ -65,6 +65,7 @@ public:
     inline float average_intensity() const { return m_points_stats[m_intensity_index].average_intensity; }
 
     void recompute_data();
+    void reset_buffers();
 
     virtual void delete_selected_points() {}
     virtual void save(const string& ) {}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <tekari/common.h>
+#include <tekari/metadata.h>
+#include <tekari/raw_measurement.h>
+
+TEKARI_NAMESPACE_BEGIN
+
+// Where the binary caches of parsed (and triangulated) datasets are stored
+enum class DatasetCacheMode
+{
+    DISABLED = 0,
+    NEXT_TO_FILE,       // <file name>.tkc, beside the measurement
+    USER_DIRECTORY      // per-user cache directory (e.g. ~/.cache/tekari)
+};
+
+extern void set_dataset_cache_mode(DatasetCacheMode mode);
+extern DatasetCacheMode dataset_cache_mode();
+
+// Try to restore everything computed from a measurement file from its cache.
+// Returns false (leaving the outputs untouched) if caching is disabled, if there is
+// no cache for this file, or if the file changed since the cache was written.
+extern bool load_dataset_cache(
+    const string& file_name,
+    RawMeasurement& raw_measurement,
+    Matrix2Xf& V2D,
+    Matrix3Xi& F,
+    VectorXu& path_segments,
+    VectorXf& wavelengths,
+    Metadata& metadata
+);
+
+// Write the cache of a measurement file (failures are reported but not fatal)
+extern void save_dataset_cache(
+    const string& file_name,
+    const RawMeasurement& raw_measurement,
+    const Matrix2Xf& V2D,
+    const Matrix3Xi& F,
+    const VectorXu& path_segments,
+    const Metadata& metadata
+);
+
+// Directional albedo of a bsdf file over a grid of incident angles (see BSDFDataset::start_computing_albedo_map)
+struct AlbedoMap
+{
+    size_t n_theta = 0;         // elevations, cell centers over [0, 85] degrees (the range of the incident angle slider)
+    size_t n_phi = 0;           // azimuths, cell centers over [-180, 180] degrees
+    size_t n_samples = 0;       // quasi-Monte Carlo samples per incident angle
+    vector<float> luminance;    // n_theta x n_phi values (row major)
+    vector<float> spectra;      // one block of n_theta x n_phi values per wavelength
+
+    bool empty() const { return luminance.empty(); }
+};
+
+// Try to restore the albedo map of a bsdf file computed on the grid and with the number of samples
+// of the given map. Albedo maps take long to compute, they are cached even if the datasets aren't
+// (in the user cache directory, unless caching next to the measurements).
+extern bool load_albedo_map_cache(const string& file_name, AlbedoMap& map);
+
+// Write the cached albedo map of a bsdf file (failures are reported but not fatal)
+extern void save_albedo_map_cache(const string& file_name, const AlbedoMap& map);
+
+TEKARI_NAMESPACE_END
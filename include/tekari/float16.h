@@ -0,0 +1,19 @@
+#pragma once
+
+#include <tekari/common.h>
+#include <tekari/powitacq.h>
+
+TEKARI_NAMESPACE_BEGIN
+
+// IEEE 754 half precision conversions (round to nearest even, infinities and NaNs preserved),
+// the same as the half precision spectra of powitacq
+
+inline uint16_t float_to_half(float value) { return powitacq::from_float<powitacq::Half>(value).bits; }
+
+inline float half_to_float(uint16_t value) { return powitacq::to_float(powitacq::Half{ value }); }
+
+inline void float_to_half(const float* in, uint16_t* out, size_t count) { powitacq::from_float(in, out, count); }
+
+inline void half_to_float(const uint16_t* in, float* out, size_t count) { powitacq::to_float(in, out, count); }
+
+TEKARI_NAMESPACE_END
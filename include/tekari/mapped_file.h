@@ -0,0 +1,35 @@
+#pragma once
+
+#include <tekari/common.h>
+
+TEKARI_NAMESPACE_BEGIN
+
+// Read-only view of a whole file, memory mapped when the platform allows it
+// (falls back to reading the file into memory otherwise)
+class MappedFile
+{
+public:
+    MappedFile(const string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    inline const char* data()  const { return m_data; }
+    inline const char* begin() const { return m_data; }
+    inline const char* end()   const { return m_data + m_size; }
+    inline size_t size()       const { return m_size; }
+
+private:
+    const char* m_data;
+    size_t m_size;
+
+#if defined(_WIN32)
+    HANDLE m_file;
+    HANDLE m_mapping;
+#elif defined(EMSCRIPTEN)
+    vector<char> m_buffer;
+#endif
+};
+
+TEKARI_NAMESPACE_END
@@ -146,13 +146,17 @@ public:
     : m_data(other.m_data)
     , m_n_cols(other.m_n_cols)
     , m_n_rows(other.m_n_rows)
-    { other.clear(); }
+    { other.release(); }
     MatrixXX& operator=(MatrixXX&& other)
     {
+        if (this == &other)
+            return *this;
+        free(m_data);
         m_data      = other.m_data;
         m_n_cols    = other.m_n_cols;
         m_n_rows    = other.m_n_rows;
-        other.clear();
+        other.release();
+        return *this;
     }
 
     ~MatrixXX() { free(m_data); }
@@ -162,7 +166,7 @@ public:
         if (n_rows == m_n_rows && n_cols == m_n_cols)
             return;
 
-        if (n_rows * sizeof(T) > std::numeric_limits<size_t>::max() / n_cols)
+        if (n_cols != 0 && n_rows * sizeof(T) > std::numeric_limits<size_t>::max() / n_cols)
             throw new std::runtime_error("Cannot allocate this many floats!");
 
         m_n_cols = n_cols;
@@ -174,6 +178,32 @@ public:
 
         m_data = new_data;
     }
+    // same as resize, but keeps the content of each row (new values are left uninitialized)
+    void conservative_resize(size_t n_rows, size_t n_cols)
+    {
+        if (n_cols == m_n_cols || m_n_rows == 0)
+        {
+            resize(n_rows, n_cols);
+            return;
+        }
+
+        size_t old_n_cols = m_n_cols;
+        size_t kept_rows = std::min(n_rows, m_n_rows);
+        if (n_cols < old_n_cols)
+        {
+            // compact rows first, then shrink the storage
+            for (size_t i = 1; i < kept_rows; ++i)
+                memmove(m_data + i * n_cols, m_data + i * old_n_cols, n_cols * sizeof(T));
+            resize(n_rows, n_cols);
+        }
+        else
+        {
+            // grow the storage first, then spread rows (starting from the last one)
+            resize(n_rows, n_cols);
+            for (size_t i = kept_rows; i-- > 1; )
+                memmove(m_data + i * n_cols, m_data + i * old_n_cols, old_n_cols * sizeof(T));
+        }
+    }
     void clear()
     {
         free(m_data);
@@ -221,6 +251,13 @@ public:
     }
 
 private:
+    // forget about the data without freeing it (ownership was transfered)
+    void release()
+    {
+        m_data = nullptr;
+        m_n_cols = m_n_rows = 0;
+    }
+
     T* m_data;
     size_t m_n_cols;
     size_t m_n_rows;
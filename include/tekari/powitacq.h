@@ -22,24 +22,36 @@
       std::valarray, which causes dynamic
       memory allocation at every BRDF evaluation.
 
-      In practice, the rendering system may only want
-      to evaluate a fixed subset of the wavelengths,
-      which could furthermore be stored on the stack.
-
-   2. The implementation doesn't rely on vectorization
-      to accelerate simultaneous evaluation at multiple
+      Overloads writing into a caller-provided array
+      (e.g. stored on the stack) avoid it, and can
+      restrict the evaluation to a subset of the
       wavelengths.
 
+   2. Simultaneous evaluation at multiple wavelengths
+      is vectorized over packets of wavelengths (the
+      spectral warp is evaluated for 8 wavelengths at
+      once). Its results are bit-identical to the scalar
+      code only when multiply-adds are not contracted into
+      fused ones (Tekari builds with -ffp-contract=off).
+
 */
 
-#pragma once
+#ifndef POWITACQ_H
+#define POWITACQ_H
 
 #include <vector>
 #include <string>
 #include <memory>
 #include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
 #include <valarray>
 
+#if defined(__F16C__)
+#  include <immintrin.h>    // half precision conversions
+#endif
+
 #define POWITACQ_NAMESPACE_BEGIN  namespace powitacq {
 #define POWITACQ_NAMESPACE_END    }
 #define POWITACQ_DIM(V)           template <size_t D = Dim, std::enable_if_t<(D >= V), int> = 0>
@@ -87,63 +99,325 @@ template <typename Type, size_t Dim> struct Vector {
 using Vector2f = Vector<float, 2>;
 using Vector3f = Vector<float, 3>;
 
+// *****************************************************************************
+// Interpolation of the parameters of a conditional warp
+
+template <size_t Dim> struct PreparedParams {
+    static constexpr size_t ArraySize = (Dim != 0) ? Dim : 1;
+
+    /// Index of the discretized value preceding each parameter
+    uint32_t index[ArraySize] = { };
+
+    /// Weights of the two discretized values enclosing each parameter
+    float weight[2 * ArraySize] = { };
+};
+
+// *****************************************************************************
+// Half precision storage
+
+/// IEEE 754 half precision value (storage only, arithmetic is done in single precision)
+struct Half { uint16_t bits; };
+
+inline float to_float(float value) { return value; }
+
+inline float to_float(Half value) {
+#if defined(__F16C__)
+    return _cvtsh_ss(value.bits);
+#else
+    /* Shift the exponent and mantissa in place, then fix up the special cases */
+    uint32_t f = (uint32_t) (value.bits & 0x7FFFu) << 13;
+    uint32_t exponent = f & (0x7C00u << 13);
+    f += (127u - 15u) << 23;
+    if (exponent == (0x7C00u << 13)) {          // inf/nan
+        f += (128u - 16u) << 23;
+    } else if (exponent == 0) {                 // zero/denormal, renormalize
+        f += 1u << 23;
+        float r;
+        memcpy(&r, &f, sizeof(float));
+        r -= 6.103515625e-05f;                  // 2^-14
+        memcpy(&f, &r, sizeof(float));
+    }
+    f |= (uint32_t) (value.bits & 0x8000u) << 16;
+    float result;
+    memcpy(&result, &f, sizeof(float));
+    return result;
+#endif
+}
+
+/// Convert \c count half precision values at once
+inline void to_float(const uint16_t *in, float *out, size_t count) {
+    size_t i = 0;
+#if defined(__F16C__)
+    for (; i + 8 <= count; i += 8)
+        _mm256_storeu_ps(out + i, _mm256_cvtph_ps(
+            _mm_loadu_si128((const __m128i *) (in + i))));
+    for (; i + 4 <= count; i += 4)
+        _mm_storeu_ps(out + i, _mm_cvtph_ps(
+            _mm_loadl_epi64((const __m128i *) (in + i))));
+#endif
+    for (; i < count; ++i)
+        out[i] = to_float(Half{ in[i] });
+}
+
+template <typename Value> Value from_float(float value);
+
+template <> inline float from_float<float>(float value) { return value; }
+
+template <> inline Half from_float<Half>(float value) {
+#if defined(__F16C__)
+    return Half{ (uint16_t) _cvtss_sh(value, _MM_FROUND_TO_NEAREST_INT) };
+#else
+    uint32_t f;
+    memcpy(&f, &value, sizeof(float));
+    uint32_t sign = f & 0x80000000u;
+    f ^= sign;
+
+    uint16_t bits;
+    if (f >= (143u << 23)) {                    // overflow (or inf/nan)
+        bits = f > (255u << 23) ? 0x7E00 : 0x7C00;
+    } else if (f < (113u << 23)) {              // denormal (or zero), let the fpu round
+        uint32_t magic_bits = 126u << 23;
+        float magic, shifted;
+        memcpy(&magic, &magic_bits, sizeof(float));
+        memcpy(&shifted, &f, sizeof(float));
+        shifted += magic;
+        memcpy(&f, &shifted, sizeof(float));
+        bits = (uint16_t) (f - magic_bits);
+    } else {                                    // rebias the exponent, round to nearest even
+        uint32_t mantissa_odd = (f >> 13) & 1;
+        f += 0xC8000FFFu + mantissa_odd;
+        bits = (uint16_t) (f >> 13);
+    }
+    return Half{ (uint16_t) (bits | (sign >> 16)) };
+#endif
+}
+
+/// Convert \c count single precision values to half precision at once
+inline void from_float(const float *in, uint16_t *out, size_t count) {
+    size_t i = 0;
+#if defined(__F16C__)
+    for (; i + 8 <= count; i += 8)
+        _mm_storeu_si128((__m128i *) (out + i), _mm256_cvtps_ph(
+            _mm256_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT));
+    for (; i + 4 <= count; i += 4)
+        _mm_storel_epi64((__m128i *) (out + i), _mm_cvtps_ph(
+            _mm_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT));
+#endif
+    for (; i < count; ++i)
+        out[i] = from_float<Half>(in[i]).bits;
+}
+
 // *****************************************************************************
 // BRDF API
 
 /// Data type used to represent spectra
 using Spectrum = std::valarray<float>;
 
+/// Selects a subset of the wavelengths (one entry per wavelength)
+using WavelengthMask = std::valarray<bool>;
+
+/// Directions stored as a structure of arrays: direction i is (x[i], y[i], z[i])
+template <typename Type> struct DirectionArrays {
+    Type *x = nullptr;
+    Type *y = nullptr;
+    Type *z = nullptr;
+
+    Vector3f operator[](size_t i) const { return Vector3f(x[i], y[i], z[i]); }
+    void set(size_t i, const Vector3f &v) { x[i] = v.x(); y[i] = v.y(); z[i] = v.z(); }
+};
+
+using Directions = DirectionArrays<const float>;
+
 class BRDF {
+public:
+    /// Durations (in microseconds) of the named stages of reading a file
+    using Timings = std::vector<std::pair<std::string, double>>;
+
+    /// Adaptive refinement of the grid sampled by set_state: the cells whose luminance or color
+    /// varies by more than 'tolerance' (relative to the peak luminance) are recursively split in
+    /// four, at most 'max_depth' times, until the state holds 'max_points' points
+    struct Refinement {
+        size_t max_points = 0;      // 0 samples the grid only
+        float tolerance = 0.05f;
+        size_t max_depth = 2;
+
+        bool operator==(const Refinement &other) const {
+            return max_points == other.max_points && tolerance == other.tolerance &&
+                   max_depth == other.max_depth;
+        }
+    };
+
+    /// Regular grid of half/difference angles (Rusinkiewicz) resampled by export_table,
+    /// the angles are taken at the center of each cell
+    struct TableGrid {
+        size_t theta_h_n = 90;      // theta_h in [0, pi/2]
+        size_t theta_d_n = 90;      // theta_d in [0, pi/2]
+        size_t phi_d_n = 180;       // phi_d in [0, pi) (reciprocity)
+        size_t phi_h_n = 1;         // phi_h in [0, 2pi), a single value (0) for isotropic BRDFs
+        bool rgb = true;            // linear sRGB, or the measured wavelengths
+    };
+
+    /// What set_state stores about an incident angle and sampling resolution (see swap_state)
+    struct State {
+        size_t theta_n = 0;
+        size_t phi_n = 0;
+        Refinement refinement;
+        size_t n_points = 0;
+        Vector3f wi = Vector3f(0.f);
+        float params[2] = { 0, 0 };
+        PreparedParams<2> prepared;
+        std::vector<Vector2f> samples;
+        std::vector<float> scales;
+    };
+
+private:
     struct Data;
-    std::unique_ptr<Data> m_data;
+    Timings m_load_timings;     // declared first, it is filled while m_data is loaded
+    // read-only tables, shared by all BRDFs loaded from the same (unmodified) file
+    std::shared_ptr<const Data> m_data;
     std::string m_description;
 
     // stores information about the currently set incident angle and sampling resolution
     size_t m_theta_n;
     size_t m_phi_n;
+    Refinement m_refinement;
     size_t m_n_points;
     Vector3f m_wi;
     float m_params[2];
+    PreparedParams<2> m_prepared;   // interpolation of m_params, shared by all the incident angle dependent warps
 
     std::vector<Vector2f> m_samples;
     std::vector<float> m_scales;
 
 public:
     // ctor / dtor
-    BRDF(const std::string &path_to_file);
+    // half_precision keeps the spectra in half precision in memory (always
+    // the case for files storing them in half precision)
+    BRDF(const std::string &path_to_file, bool half_precision = false);
     ~BRDF();
 
     /// get the wavelengths sample points
     const Spectrum &wavelengths() const;
 
+    /// get the number of wavelengths sample points
+    size_t n_wavelengths() const;
+
+    /// whether the BRDF only depends on the difference of the azimuths of wi and wo
+    bool isotropic() const;
+
     /// evaluate f_r * cos
     Spectrum eval(const Vector3f &wi, const Vector3f &wo) const;
 
+    /// evaluate f_r * cos into out (n_wavelengths() values), without allocating.
+    /// If mask is given, only the selected wavelengths are written.
+    void eval(const Vector3f &wi, const Vector3f &wo, float *out,
+              const WavelengthMask *mask = nullptr) const;
+
     /// importance sample f_r * cos using two uniform variates
     Spectrum sample(const Vector2f &u,
                     const Vector3f &wi,
                     Vector3f *wo = nullptr,
                     float *pdf = nullptr) const;
 
+    /// importance sample f_r * cos into out (see eval)
+    void sample(const Vector2f &u,
+                const Vector3f &wi,
+                float *out,
+                Vector3f *wo = nullptr,
+                float *pdf = nullptr,
+                const WavelengthMask *mask = nullptr) const;
+
     // Sets the incident angle (and sampling resolution) and stores what's necessary to compute the corresponding measurement
     // Returns false if the state didn't change with the given parameters
     bool set_state(const Vector3f &wi, size_t theta_n, size_t phi_n,
                   std::vector<float>& luminance_out, std::vector<Vector3f>& wos_out,
                   std::vector<Vector3f>& color_out);
+    // Same, adaptively refining the theta_n x phi_n grid where the measurement varies the most (see Refinement).
+    // Setting 'cancelled' (from another thread) stops the computation after the rows being sampled,
+    // the BRDF is then left without a state and false is returned
+    bool set_state(const Vector3f &wi, size_t theta_n, size_t phi_n,
+                  std::vector<float>& luminance_out, std::vector<Vector3f>& wos_out,
+                  std::vector<Vector3f>& color_out, const Refinement &refinement,
+                  const std::atomic<bool> *cancelled = nullptr);
+    // Exchanges the current state with the given one, which allows restoring a state
+    // previously set without recomputing it (swapping with a default State clears it)
+    void swap_state(State &state);
     void sample_state(size_t wavelength_index, float* frs_out) const;
+    // Samples all the wavelengths in one pass: frs_out[i * row_stride + j] receives wavelength i at point j
+    void sample_state_all(float* frs_out, size_t row_stride) const;
     Spectrum sample_state(size_t point_index) const;
+    // Samples the spectrum of a point into out (see eval)
+    void sample_state_spectrum(size_t point_index, float *out,
+                               const WavelengthMask *mask = nullptr) const;
 
     /// evaluate the PDF of a sample
     float pdf(const Vector3f &wi, const Vector3f &wo) const;
 
+    /// evaluate f_r * cos for n pairs of directions in parallel: out[i * out_stride + j]
+    /// receives wavelength i of pair j (only the selected wavelengths if mask is given)
+    void eval_batch(size_t n, const Directions &wi, const Directions &wo,
+                    float *out, size_t out_stride,
+                    const WavelengthMask *mask = nullptr) const;
+
+    /// evaluate f_r * cos in linear sRGB for n pairs of directions in parallel:
+    /// rgb_out[c * out_stride + j] receives channel c of pair j
+    void eval_rgb_batch(size_t n, const Directions &wi, const Directions &wo,
+                        float *rgb_out, size_t out_stride) const;
+
+    /// importance sample f_r * cos for n incident directions and pairs of
+    /// variates (u1[j], u2[j]) in parallel, the spectra are written as by
+    /// eval_batch and the sampled directions and pdfs are stored if requested
+    void sample_batch(size_t n, const float *u1, const float *u2,
+                      const Directions &wi, float *out, size_t out_stride,
+                      DirectionArrays<float> *wo_out = nullptr,
+                      float *pdf_out = nullptr,
+                      const WavelengthMask *mask = nullptr) const;
+
+    /// evaluate the PDF of n pairs of directions in parallel
+    void pdf_batch(size_t n, const Directions &wi, const Directions &wo,
+                   float *pdf_out) const;
+
+    /// directional albedo (integral of f_r * cos over the outgoing directions) of n incident
+    /// directions: out[i * out_stride + j] receives wavelength i of direction j and
+    /// luminance_out[j] (if given) its luminance. Each direction is integrated by
+    /// quasi-Monte Carlo with n_samples importance samples (a Hammersley set), in parallel
+    /// across directions and batches of samples
+    void albedo_batch(size_t n, const Directions &wi, size_t n_samples,
+                      float *out, size_t out_stride,
+                      float *luminance_out = nullptr) const;
+
+    /// resample f_r (without the cosine) onto a grid of half/difference angles and write it
+    /// to a tensor file block after block, so that the table is never held in memory:
+    /// field "values" has shape [phi_h_n, theta_h_n, theta_d_n, phi_d_n, channels] and
+    /// "phi_h", "theta_h", "theta_d", "phi_d" (and "wavelengths" if spectral) the grid
+    void export_table(const std::string &path, const TableGrid &grid) const;
+
     const std::string& description() const { return m_description; }
 
+    /// Stages of reading the file (empty if its data was shared with another BRDF)
+    const Timings& load_timings() const { return m_load_timings; }
+
 private:
     Spectrum zero() const;
+
+    // maps a pair of directions to the point of the tabulated spectra and the
+    // scale of f_r * cos (returns false if either direction is below the horizon)
+    bool lookup(const Vector3f &wi, const Vector3f &wo, Vector2f &sample,
+                PreparedParams<2> &prepared, float &scale) const;
+
+    // returns the data of the given file, reusing the one already in memory when possible
+    static std::shared_ptr<const Data> load_data(const std::string &path_to_file, bool half_precision,
+                                                 Timings &timings);
+    static std::shared_ptr<const Data> read_data(const std::string &path_to_file, bool half_precision,
+                                                 Timings &timings);
 };
 
 POWITACQ_NAMESPACE_END
 
-#ifdef POWITACQ_IMPLEMENTATION
+#endif // POWITACQ_H
+
+// the implementation can be requested after the declarations were included (e.g. through float16.h)
+#if defined(POWITACQ_IMPLEMENTATION) && !defined(POWITACQ_IMPLEMENTATION_INCLUDED)
+#  define POWITACQ_IMPLEMENTATION_INCLUDED
 #  include "powitacq.inl"
 #endif
@@ -5,6 +5,28 @@
 #include <limits>         // std::numeric_limits
 #include <sstream>        // std::ostringstream
 #include <unordered_map>
+#include <algorithm>      // std::sort
+#include <mutex>
+#include <filesystem>
+#include <cstdio>         // fopen, fread (fallback when files can't be mapped)
+#include <chrono>         // timings of the loading stages
+
+#if defined(POWITACQ_USE_TBB)
+#  include <tbb/parallel_for.h>
+#endif
+
+#if defined(_WIN32)
+#  if !defined(NOMINMAX)
+#    define NOMINMAX
+#  endif
+#  include <windows.h>
+#elif !defined(EMSCRIPTEN)
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
 #include "cie1931.h"
 
 #define POWITACQ_SAMPLE_LUMINANCE 0
@@ -160,6 +182,200 @@ size_t find_interval(size_t size_, const Predicate &pred) {
                           (ssize_t) size_ - 2);
 }
 
+// *****************************************************************************
+// Packets (several samples evaluated at once)
+// *****************************************************************************
+
+/// Number of samples processed together by the packet variants of the warps
+static constexpr size_t PacketSize = 8;
+
+/**
+ * \brief Values of \c PacketSize samples
+ *
+ * All operations are plain loops over the lanes, written so that the
+ * compiler maps them to SIMD instructions.
+ */
+template <typename T> struct Packet {
+    Packet() = default;
+
+    /// Constant initialization
+    Packet(T v) {
+        for (size_t i = 0; i < PacketSize; ++i)
+            values[i] = v;
+    }
+
+    /// Converting copy-constructor
+    template <typename T2> explicit Packet(const Packet<T2> &p) {
+        for (size_t i = 0; i < PacketSize; ++i)
+            values[i] = (T) p[i];
+    }
+
+    T &operator[](size_t i) { return values[i]; }
+    const T &operator[](size_t i) const { return values[i]; }
+
+    T values[PacketSize];
+};
+
+using FloatP    = Packet<float>;
+using UInt32P   = Packet<uint32_t>;
+using MaskP     = Packet<bool>;
+using Vector2fP = Vector<FloatP, 2>;
+using Vector3fP = Vector<FloatP, 3>;
+
+#define POWITACQ_PACKET_OPERATOR(op, Result)                                   \
+    template <typename T>                                                      \
+    Packet<Result> operator op(const Packet<T> &p1, const Packet<T> &p2) {     \
+        Packet<Result> result;                                                 \
+        for (size_t i = 0; i < PacketSize; ++i)                                \
+            result[i] = p1[i] op p2[i];                                        \
+        return result;                                                         \
+    }                                                                          \
+    template <typename T>                                                      \
+    Packet<Result> operator op(const Packet<T> &p, T s) {                      \
+        return p op Packet<T>(s);                                              \
+    }                                                                          \
+    template <typename T>                                                      \
+    Packet<Result> operator op(T s, const Packet<T> &p) {                      \
+        return Packet<T>(s) op p;                                              \
+    }
+
+#define POWITACQ_PACKET_OPERATOR_COMPOUND(op)                                  \
+    template <typename T>                                                      \
+    Packet<T> &operator op(Packet<T> &p1, const Packet<T> &p2) {               \
+        for (size_t i = 0; i < PacketSize; ++i)                                \
+            p1[i] op p2[i];                                                    \
+        return p1;                                                             \
+    }                                                                          \
+    template <typename T>                                                      \
+    Packet<T> &operator op(Packet<T> &p, T s) {                                \
+        return p op Packet<T>(s);                                              \
+    }
+
+POWITACQ_PACKET_OPERATOR(+, T)
+POWITACQ_PACKET_OPERATOR_COMPOUND(+=)
+POWITACQ_PACKET_OPERATOR(-, T)
+POWITACQ_PACKET_OPERATOR_COMPOUND(-=)
+POWITACQ_PACKET_OPERATOR(*, T)
+POWITACQ_PACKET_OPERATOR_COMPOUND(*=)
+POWITACQ_PACKET_OPERATOR(/, T)
+POWITACQ_PACKET_OPERATOR_COMPOUND(/=)
+POWITACQ_PACKET_OPERATOR(<, bool)
+POWITACQ_PACKET_OPERATOR(<=, bool)
+POWITACQ_PACKET_OPERATOR(>, bool)
+POWITACQ_PACKET_OPERATOR(==, bool)
+
+#undef POWITACQ_PACKET_OPERATOR
+#undef POWITACQ_PACKET_OPERATOR_COMPOUND
+
+inline FloatP fma(const FloatP &a, const FloatP &b, const FloatP &c) {
+    FloatP result;
+    for (size_t i = 0; i < PacketSize; ++i)
+        result[i] = fma(a[i], b[i], c[i]);
+    return result;
+}
+
+inline bool all(const MaskP &mask) {
+    bool result = true;
+    for (size_t i = 0; i < PacketSize; ++i)
+        result &= mask[i];
+    return result;
+}
+
+template <typename T>
+Packet<T> select(const MaskP &mask, const Packet<T> &a, const Packet<T> &b) {
+    Packet<T> result;
+    for (size_t i = 0; i < PacketSize; ++i)
+        result[i] = mask[i] ? a[i] : b[i];
+    return result;
+}
+
+inline FloatP clamp(const FloatP &value, float min_value, float max_value) {
+    FloatP result;
+    for (size_t i = 0; i < PacketSize; ++i)
+        result[i] = clamp(value[i], min_value, max_value);
+    return result;
+}
+
+inline UInt32P min(const UInt32P &value, uint32_t max_value) {
+    UInt32P result;
+    for (size_t i = 0; i < PacketSize; ++i)
+        result[i] = std::min(value[i], max_value);
+    return result;
+}
+
+inline FloatP sqrt(const FloatP &value) {
+    FloatP result;
+    for (size_t i = 0; i < PacketSize; ++i)
+        result[i] = std::sqrt(value[i]);
+    return result;
+}
+
+inline FloatP abs(const FloatP &value) {
+    FloatP result;
+    for (size_t i = 0; i < PacketSize; ++i)
+        result[i] = std::abs(value[i]);
+    return result;
+}
+
+/// Fetch (and convert to single precision) the values at the given indices
+template <typename T> FloatP gather(const T *data, const UInt32P &index) {
+    FloatP result;
+    for (size_t i = 0; i < PacketSize; ++i)
+        result[i] = to_float(data[index[i]]);
+    return result;
+}
+
+inline FloatP gather(const Half *data, const UInt32P &index) {
+    uint16_t bits[PacketSize];
+    for (size_t i = 0; i < PacketSize; ++i)
+        bits[i] = data[index[i]].bits;
+    FloatP result;
+    to_float(bits, result.values, PacketSize);
+    return result;
+}
+
+/**
+ * \brief Packet variant of \c find_interval()
+ *
+ * The search range is the same for all lanes, so the bisection is written
+ * with a fixed number of steps (each lane only selects which half it keeps).
+ * For a monotonic predicate, the result is the same as \c find_interval().
+ */
+template <typename Predicate>
+UInt32P find_interval_packet(uint32_t size, const Predicate &pred) {
+    UInt32P first(0u);
+    uint32_t n = size > 1 ? size - 1 : 1;     // candidates: [0, size - 2]
+    while (n > 1) {
+        uint32_t half = n >> 1;
+        UInt32P middle = first + half;
+        first = select(pred(middle), middle, first);
+        n -= half;
+    }
+    return first;
+}
+
+// *****************************************************************************
+// Parallel loops
+// *****************************************************************************
+
+/// Call \c f(i) for each \c i in <tt>[begin, end)</tt>, in parallel if TBB is available
+template <typename Func>
+void parallel_for(size_t begin, size_t end, const Func &f) {
+#if defined(POWITACQ_USE_TBB)
+    if (begin >= end)
+        return;
+    tbb::parallel_for(tbb::blocked_range<size_t>(begin, end),
+        [&](const tbb::blocked_range<size_t> &range) {
+            for (size_t i = range.begin(); i != range.end(); ++i)
+                f(i);
+        }
+    );
+#else
+    for (size_t i = begin; i < end; ++i)
+        f(i);
+#endif
+}
+
 // *****************************************************************************
 // Marginal-conditional warp
 // *****************************************************************************
@@ -187,10 +403,47 @@ size_t find_interval(size_t size_, const Predicate &pred) {
  * and <tt>param_values</tt> should contain the parameter values where the
  * distribution is discretized. Linear interpolation is used when sampling or
  * evaluating the distribution for in-between parameter values.
+ *
+ * The density values are stored as \c Value, which can be \c Half to halve
+ * the memory footprint of large tables (the cdfs are always kept in single
+ * precision).
  */
-template <size_t Dimension = 0> class Marginal2D {
+template <size_t Dimension = 0, typename Value = float> class Marginal2D {
 private:
-    using FloatStorage = std::vector<float>;
+    /**
+     * Array of values which either owns them, or refers to values stored
+     * elsewhere (e.g. in a memory mapped file) that are kept alive by a
+     * shared owner.
+     */
+    template <typename T> class Storage {
+    public:
+        Storage() = default;
+        explicit Storage(size_t size)
+            : m_values(size), m_data(m_values.data()), m_size(size) { }
+        Storage(const T *data, size_t size, std::shared_ptr<const void> owner)
+            : m_owner(std::move(owner)), m_data(data), m_size(size) { }
+
+        /* Moving a std::vector keeps its buffer, so m_data stays valid */
+        Storage(Storage &&) = default;
+        Storage &operator=(Storage &&) = default;
+        Storage(const Storage &) = delete;
+        Storage &operator=(const Storage &) = delete;
+
+        /// Writable access, only valid for storage owning its values
+        T *data() { return m_values.data(); }
+        const T *data() const { return m_data; }
+        float operator[](size_t i) const { return to_float(m_data[i]); }
+        size_t size() const { return m_size; }
+
+    private:
+        std::vector<T> m_values;
+        std::shared_ptr<const void> m_owner;
+        const T *m_data = nullptr;
+        size_t m_size = 0;
+    };
+
+    using FloatStorage = Storage<float>;
+    using ValueStorage = Storage<Value>;
 
 #if !defined(_MSC_VER)
     static constexpr size_t ArraySize = Dimension;
@@ -199,6 +452,9 @@ private:
 #endif
 
 public:
+    /// Parameter indices and interpolation weights, see \c prepare()
+    using Prepared = PreparedParams<Dimension>;
+
     Marginal2D() = default;
 
     /**
@@ -217,13 +473,20 @@ public:
      * construct the cdf needed for sample warping, which saves memory in case
      * this functionality is not needed (e.g. if only the interpolation in \c
      * eval() is used).
+     *
+     * If \c owner is provided and neither normalization nor the cdf are
+     * requested, the implementation refers to \c data directly instead of
+     * copying it (provided it is already stored as \c Value). \c owner then
+     * keeps \c data alive for the lifetime of the warp.
      */
-    Marginal2D(const Vector2u &size, const float *data,
+    template <typename Input>
+    Marginal2D(const Vector2u &size, const Input *data,
                std::array<uint32_t, Dimension> param_res = { },
                std::array<const float *, Dimension> param_values = { },
-               bool normalize = true, bool build_cdf = true)
+               bool normalize = true, bool build_cdf = true,
+               std::shared_ptr<const void> owner = nullptr)
         : m_size(size), m_patch_size(Vector2f(1.f) / Vector2f(m_size - 1u)),
-          m_inv_patch_size(m_size - 1u) {
+          m_inv_patch_size(m_size - 1u), m_eval_scale(hprod(m_inv_patch_size)) {
 
         if (build_cdf && !normalize)
             throw std::runtime_error("Marginal2D: build_cdf implies normalize=true");
@@ -244,15 +507,24 @@ public:
 
         uint32_t n_values = hprod(size);
 
-        m_data = FloatStorage(slices * n_values);
+        if constexpr (std::is_same<Input, Value>::value) {
+            if (owner && !normalize) {
+                /* The values are used as-is: reference them instead of copying */
+                m_data = ValueStorage(data, slices * n_values, std::move(owner));
+                m_eval_scale = 1.f;
+                return;
+            }
+        }
+
+        m_data = ValueStorage(slices * n_values);
 
         if (build_cdf) {
             m_marginal_cdf = FloatStorage(slices * m_size.y());
             m_conditional_cdf = FloatStorage(slices * n_values);
 
             float *marginal_cdf = m_marginal_cdf.data(),
-                  *conditional_cdf = m_conditional_cdf.data(),
-                  *data_out = m_data.data();
+                  *conditional_cdf = m_conditional_cdf.data();
+            Value *data_out = m_data.data();
 
             for (uint32_t slice = 0; slice < slices; ++slice) {
                 /* Construct conditional CDF */
@@ -261,7 +533,8 @@ public:
                     size_t i = y * size.x();
                     conditional_cdf[i] = 0.f;
                     for (uint32_t x = 0; x < m_size.x() - 1; ++x, ++i) {
-                        sum += .5 * ((double) data[i] + (double) data[i + 1]);
+                        sum += .5 * ((double) to_float(data[i]) +
+                                     (double) to_float(data[i + 1]));
                         conditional_cdf[i + 1] = (float) sum;
                     }
                 }
@@ -282,7 +555,7 @@ public:
                 for (size_t i = 0; i < m_size.y(); ++i)
                     marginal_cdf[i] *= normalization;
                 for (size_t i = 0; i < n_values; ++i)
-                    data_out[i] = data[i] * normalization;
+                    data_out[i] = from_float<Value>(to_float(data[i]) * normalization);
 
                 marginal_cdf += m_size.y();
                 conditional_cdf += n_values;
@@ -290,19 +563,26 @@ public:
                 data += n_values;
             }
         } else {
-            float *data_out = m_data.data();
+            Value *data_out = m_data.data();
+
+            /* Half precision values are stored unscaled: dividing them by the
+               patch count first would push small values into the subnormal
+               range (or to zero) of half precision */
+            bool scaled = normalize || !std::is_same<Value, Half>::value;
+            if (!scaled)
+                m_eval_scale = 1.f;
 
             for (uint32_t slice = 0; slice < slices; ++slice) {
-                float normalization = 1.f / hprod(m_inv_patch_size);
+                float normalization = scaled ? 1.f / hprod(m_inv_patch_size) : 1.f;
                 if (normalize) {
                     double sum = 0.0;
                     for (uint32_t y = 0; y < m_size.y() - 1; ++y) {
                         size_t i = y * size.x();
                         for (uint32_t x = 0; x < m_size.x() - 1; ++x, ++i) {
-                            float v00 = data[i],
-                                  v10 = data[i + 1],
-                                  v01 = data[i + size.x()],
-                                  v11 = data[i + 1 + size.x()],
+                            float v00 = to_float(data[i]),
+                                  v10 = to_float(data[i + 1]),
+                                  v01 = to_float(data[i + size.x()]),
+                                  v11 = to_float(data[i + 1 + size.x()]),
                                   avg = .25f * (v00 + v10 + v01 + v11);
                             sum += (double) avg;
                         }
@@ -311,7 +591,7 @@ public:
                 }
 
                 for (uint32_t k = 0; k < n_values; ++k)
-                    data_out[k] = data[k] * normalization;
+                    data_out[k] = from_float<Value>(to_float(data[k]) * normalization);
 
                 data += n_values;
                 data_out += n_values;
@@ -321,41 +601,76 @@ public:
 
 
     /**
-     * \brief Given a uniformly distributed 2D sample, draw a sample from the
-     * distribution (parameterized by \c param if applicable)
-     *
-     * Returns the warped sample and associated probability density.
+     * \brief Look up the parameter indices and interpolation weights of
+     * \c param once, so that they can be reused by several calls to
+     * \c sample(), \c invert() and \c eval()
      */
-    std::pair<Vector2f, float> sample(Vector2f sample,
-                                      const float *param = nullptr) const {
-        /* Avoid degeneracies at the extrema */
-        sample = clamp(sample, 1.f - OneMinusEpsilon, OneMinusEpsilon);
+    Prepared prepare(const float *param) const {
+        return prepare(PreparedParams<0>(), param);
+    }
 
-        /* Look up parameter-related indices and weights (if Dimension != 0) */
-        float param_weight[2 * ArraySize];
-        uint32_t slice_offset = 0u;
-        for (size_t dim = 0; dim < Dimension; ++dim) {
+    /**
+     * \brief Variant of \c prepare() that takes the first \c Leading
+     * parameters from \c leading, which must have been prepared by a warp
+     * discretizing them in the same way (only the remaining entries of
+     * \c param are looked up)
+     */
+    template <size_t Leading>
+    Prepared prepare(const PreparedParams<Leading> &leading,
+                     const float *param) const {
+        static_assert(Leading <= Dimension, "Too many leading parameters");
+        Prepared prepared;
+        for (size_t dim = 0; dim < Leading; ++dim) {
+            prepared.index[dim] = leading.index[dim];
+            prepared.weight[2 * dim] = leading.weight[2 * dim];
+            prepared.weight[2 * dim + 1] = leading.weight[2 * dim + 1];
+        }
+
+        for (size_t dim = Leading; dim < Dimension; ++dim) {
             if (m_param_size[dim] == 1) {
-                param_weight[2 * dim] = 1.f;
-                param_weight[2 * dim + 1] = 0.f;
+                prepared.index[dim] = 0;
+                prepared.weight[2 * dim] = 1.f;
+                prepared.weight[2 * dim + 1] = 0.f;
                 continue;
             }
 
             uint32_t param_index = find_interval(
                 m_param_size[dim],
                 [&](uint32_t idx) {
-                    return m_param_values[dim].data()[idx] <= param[dim];
+                    return m_param_values[dim][idx] <= param[dim];
                 }
             );
 
             float p0 = m_param_values[dim][param_index],
                   p1 = m_param_values[dim][param_index + 1];
 
-            param_weight[2 * dim + 1] =
+            prepared.index[dim] = param_index;
+            prepared.weight[2 * dim + 1] =
                 clamp((param[dim] - p0) / (p1 - p0), 0.f, 1.f);
-            param_weight[2 * dim] = 1.f - param_weight[2 * dim + 1];
-            slice_offset += m_param_strides[dim] * param_index;
+            prepared.weight[2 * dim] = 1.f - prepared.weight[2 * dim + 1];
         }
+        return prepared;
+    }
+
+    /**
+     * \brief Given a uniformly distributed 2D sample, draw a sample from the
+     * distribution (parameterized by \c param if applicable)
+     *
+     * Returns the warped sample and associated probability density.
+     */
+    std::pair<Vector2f, float> sample(const Vector2f &sample,
+                                      const float *param = nullptr) const {
+        return this->sample(sample, prepare(param));
+    }
+
+    /// Variant of \c sample() using parameters interpolated by \c prepare()
+    std::pair<Vector2f, float> sample(Vector2f sample,
+                                      const Prepared &prepared) const {
+        /* Avoid degeneracies at the extrema */
+        sample = clamp(sample, 1.f - OneMinusEpsilon, OneMinusEpsilon);
+
+        const float *param_weight = prepared.weight;
+        uint32_t slice_offset = this->slice_offset(prepared);
 
         /* Sample the row first */
         uint32_t offset = 0;
@@ -439,33 +754,16 @@ public:
     }
 
     /// Inverse of the mapping implemented in \c sample()
-    std::pair<Vector2f, float> invert(Vector2f sample,
+    std::pair<Vector2f, float> invert(const Vector2f &sample,
                                       const float *param = nullptr) const {
-        /* Look up parameter-related indices and weights (if Dimension != 0) */
-        float param_weight[2 * ArraySize];
-        uint32_t slice_offset = 0u;
-        for (size_t dim = 0; dim < Dimension; ++dim) {
-            if (m_param_size[dim] == 1) {
-                param_weight[2 * dim] = 1.f;
-                param_weight[2 * dim + 1] = 0.f;
-                continue;
-            }
-
-            uint32_t param_index = find_interval(
-                m_param_size[dim],
-                [&](uint32_t idx) {
-                    return m_param_values[dim][idx] <= param[dim];
-                }
-            );
-
-            float p0 = m_param_values[dim][param_index],
-                  p1 = m_param_values[dim][param_index + 1];
+        return invert(sample, prepare(param));
+    }
 
-            param_weight[2 * dim + 1] =
-                clamp((param[dim] - p0) / (p1 - p0), 0.f, 1.f);
-            param_weight[2 * dim] = 1.f - param_weight[2 * dim + 1];
-            slice_offset += m_param_strides[dim] * param_index;
-        }
+    /// Variant of \c invert() using parameters interpolated by \c prepare()
+    std::pair<Vector2f, float> invert(Vector2f sample,
+                                      const Prepared &prepared) const {
+        const float *param_weight = prepared.weight;
+        uint32_t slice_offset = this->slice_offset(prepared);
 
         /* Fetch values at corners of bilinear patch */
         sample *= m_inv_patch_size;
@@ -532,32 +830,14 @@ public:
      * \brief Evaluate the density at position \c pos. The distribution is
      * parameterized by \c param if applicable.
      */
-    float eval(Vector2f pos, const float *param = nullptr) const {
-        /* Look up parameter-related indices and weights (if Dimension != 0) */
-        float param_weight[2 * ArraySize];
-        uint32_t slice_offset = 0u;
-
-        for (size_t dim = 0; dim < Dimension; ++dim) {
-            if (m_param_size[dim] == 1) {
-                param_weight[2 * dim] = 1.f;
-                param_weight[2 * dim + 1] = 0.f;
-                continue;
-            }
-
-            uint32_t param_index = find_interval(
-                m_param_size[dim],
-                [&](uint32_t idx) {
-                    return m_param_values[dim][idx] <= param[dim];
-                });
-
-            float p0 = m_param_values[dim][param_index],
-                  p1 = m_param_values[dim][param_index + 1];
+    float eval(const Vector2f &pos, const float *param = nullptr) const {
+        return eval(pos, prepare(param));
+    }
 
-            param_weight[2 * dim + 1] =
-                clamp((param[dim] - p0) / (p1 - p0), 0.f, 1.f);
-            param_weight[2 * dim] = 1.f - param_weight[2 * dim + 1];
-            slice_offset += m_param_strides[dim] * param_index;
-        }
+    /// Variant of \c eval() using parameters interpolated by \c prepare()
+    float eval(Vector2f pos, const Prepared &prepared) const {
+        const float *param_weight = prepared.weight;
+        uint32_t slice_offset = this->slice_offset(prepared);
 
         /* Compute linear interpolation weights */
         pos *= m_inv_patch_size;
@@ -583,12 +863,375 @@ public:
 
         return fma(w0.y(), fma(w0.x(), v00, w1.x() * v10),
                         w1.y() * fma(w0.x(), v01, w1.x() * v11)) *
-               hprod(m_inv_patch_size);
+               m_eval_scale;
+    }
+
+    /// Packet variant of \c sample()
+    std::pair<Vector2fP, FloatP> sample(const Vector2fP &sample,
+                                        const FloatP *param = nullptr) const {
+        return this->sample(sample, PreparedParams<0>(), param);
+    }
+
+    /**
+     * \brief Packet variant of \c sample(), where the first \c Leading
+     * parameters are shared by all lanes and were interpolated by \c prepare()
+     */
+    template <size_t Leading>
+    std::pair<Vector2fP, FloatP> sample(Vector2fP sample,
+                                        const PreparedParams<Leading> &prepared,
+                                        const FloatP *param = nullptr) const {
+        /* Avoid degeneracies at the extrema */
+        sample.x() = clamp(sample.x(), 1.f - OneMinusEpsilon, OneMinusEpsilon);
+        sample.y() = clamp(sample.y(), 1.f - OneMinusEpsilon, OneMinusEpsilon);
+
+        FloatP param_weight[2 * ArraySize];
+        uint32_t single_slice;
+        UInt32P slice_offset = interpolate_params(prepared, param, param_weight, single_slice);
+
+        /* Sample the row first */
+        UInt32P offset(0u);
+        if (Dimension != 0)
+            offset = slice_offset * m_size.y();
+
+        auto fetch_marginal = [&](const UInt32P &idx) -> FloatP {
+            return lookup<Dimension>(m_marginal_cdf.data(), offset + idx,
+                                     m_size.y(), param_weight, single_slice);
+        };
+
+        UInt32P row = find_interval_packet(
+            m_size.y(),
+            [&](const UInt32P &idx) {
+                return fetch_marginal(idx) < sample.y();
+            }
+        );
+
+        sample.y() -= fetch_marginal(row);
+
+        uint32_t slice_size = hprod(m_size);
+        offset = row * m_size.x();
+        if (Dimension != 0)
+            offset += slice_offset * slice_size;
+
+        FloatP r0 = lookup<Dimension>(m_conditional_cdf.data(),
+                                      offset + (m_size.x() - 1), slice_size,
+                                      param_weight, single_slice),
+               r1 = lookup<Dimension>(m_conditional_cdf.data(),
+                                      offset + (m_size.x() * 2 - 1), slice_size,
+                                      param_weight, single_slice);
+
+        MaskP is_const = abs(r0 - r1) < 1e-4f * (r0 + r1);
+        sample.y() = select(is_const, 2.f * sample.y(),
+            r0 - sqrt(r0 * r0 - 2.f * sample.y() * (r0 - r1)));
+        sample.y() /= select(is_const, r0 + r1, r0 - r1);
+
+        /* Sample the column next */
+        sample.x() *= (1.f - sample.y()) * r0 + sample.y() * r1;
+
+        auto fetch_conditional = [&](const UInt32P &idx) -> FloatP {
+            FloatP v0 = lookup<Dimension>(m_conditional_cdf.data(), offset + idx,
+                                          slice_size, param_weight, single_slice),
+                   v1 = lookup<Dimension>(m_conditional_cdf.data() + m_size.x(),
+                                          offset + idx, slice_size, param_weight, single_slice);
+
+            return (1.f - sample.y()) * v0 + sample.y() * v1;
+        };
+
+        UInt32P col = find_interval_packet(
+            m_size.x(),
+            [&](const UInt32P &idx) {
+                return fetch_conditional(idx) < sample.x();
+            }
+        );
+
+        sample.x() -= fetch_conditional(col);
+
+        offset += col;
+
+        FloatP v00 = lookup<Dimension>(m_data.data(), offset, slice_size,
+                                       param_weight, single_slice),
+               v10 = lookup<Dimension>(m_data.data() + 1, offset, slice_size,
+                                       param_weight, single_slice),
+               v01 = lookup<Dimension>(m_data.data() + m_size.x(), offset,
+                                       slice_size, param_weight, single_slice),
+               v11 = lookup<Dimension>(m_data.data() + m_size.x() + 1, offset,
+                                       slice_size, param_weight, single_slice),
+               c0  = fma((1.f - sample.y()), v00, sample.y() * v01),
+               c1  = fma((1.f - sample.y()), v10, sample.y() * v11);
+
+        is_const = abs(c0 - c1) < 1e-4f * (c0 + c1);
+        sample.x() = select(is_const, 2.f * sample.x(),
+            c0 - sqrt(c0 * c0 - 2.f * sample.x() * (c0 - c1)));
+        sample.x() /= select(is_const, c0 + c1, c0 - c1);
+
+        return {
+            Vector2fP((FloatP(col) + sample.x()) * m_patch_size.x(),
+                      (FloatP(row) + sample.y()) * m_patch_size.y()),
+            ((1.f - sample.x()) * c0 + sample.x() * c1) * hprod(m_inv_patch_size)
+        };
+    }
+
+    /// Packet variant of \c invert()
+    std::pair<Vector2fP, FloatP> invert(const Vector2fP &sample,
+                                        const FloatP *param = nullptr) const {
+        return invert(sample, PreparedParams<0>(), param);
+    }
+
+    /// Packet variant of \c invert(), see the packet variant of \c sample()
+    template <size_t Leading>
+    std::pair<Vector2fP, FloatP> invert(Vector2fP sample,
+                                        const PreparedParams<Leading> &prepared,
+                                        const FloatP *param = nullptr) const {
+        FloatP param_weight[2 * ArraySize];
+        uint32_t single_slice;
+        UInt32P slice_offset = interpolate_params(prepared, param, param_weight, single_slice);
+
+        /* Fetch values at corners of bilinear patch */
+        sample.x() *= m_inv_patch_size.x();
+        sample.y() *= m_inv_patch_size.y();
+        UInt32P pos_x = min(UInt32P(sample.x()), m_size.x() - 2u),
+                pos_y = min(UInt32P(sample.y()), m_size.y() - 2u);
+        sample.x() -= FloatP(pos_x);
+        sample.y() -= FloatP(pos_y);
+
+        UInt32P offset = pos_x + pos_y * m_size.x();
+        uint32_t slice_size = hprod(m_size);
+        if (Dimension != 0)
+            offset += slice_offset * slice_size;
+
+        /* Invert the X component */
+        FloatP v00 = lookup<Dimension>(m_data.data(), offset, slice_size,
+                                       param_weight, single_slice),
+               v10 = lookup<Dimension>(m_data.data() + 1, offset, slice_size,
+                                       param_weight, single_slice),
+               v01 = lookup<Dimension>(m_data.data() + m_size.x(), offset, slice_size,
+                                       param_weight, single_slice),
+               v11 = lookup<Dimension>(m_data.data() + m_size.x() + 1, offset, slice_size,
+                                       param_weight, single_slice);
+
+        FloatP w1_x = sample.x(), w1_y = sample.y(),
+               w0_x = 1.f - w1_x, w0_y = 1.f - w1_y;
+
+        FloatP c0  = fma(w0_y, v00, w1_y * v01),
+               c1  = fma(w0_y, v10, w1_y * v11),
+               pdf = fma(w0_x, c0, w1_x * c1);
+
+        sample.x() *= c0 + .5f * sample.x() * (c1 - c0);
+
+        FloatP v0 = lookup<Dimension>(m_conditional_cdf.data(), offset,
+                                      slice_size, param_weight, single_slice),
+               v1 = lookup<Dimension>(m_conditional_cdf.data() + m_size.x(),
+                                      offset, slice_size, param_weight, single_slice);
+
+        sample.x() += (1.f - sample.y()) * v0 + sample.y() * v1;
+
+        offset = pos_y * m_size.x();
+        if (Dimension != 0)
+            offset += slice_offset * slice_size;
+
+        FloatP r0 = lookup<Dimension>(m_conditional_cdf.data(),
+                                      offset + (m_size.x() - 1), slice_size,
+                                      param_weight, single_slice),
+               r1 = lookup<Dimension>(m_conditional_cdf.data(),
+                                      offset + (m_size.x() * 2 - 1), slice_size,
+                                      param_weight, single_slice);
+
+        sample.x() /= (1.f - sample.y()) * r0 + sample.y() * r1;
+
+        /* Invert the Y component */
+        sample.y() *= r0 + .5f * sample.y() * (r1 - r0);
+
+        offset = pos_y;
+        if (Dimension != 0)
+            offset += slice_offset * m_size.y();
+
+        sample.y() += lookup<Dimension>(m_marginal_cdf.data(), offset,
+                                        m_size.y(), param_weight, single_slice);
+
+        return { sample, pdf * hprod(m_inv_patch_size) };
+    }
+
+    /// Packet variant of \c eval()
+    FloatP eval(const Vector2fP &pos, const FloatP *param = nullptr) const {
+        return eval(pos, PreparedParams<0>(), param);
+    }
+
+    /// Packet variant of \c eval(), see the packet variant of \c sample()
+    template <size_t Leading>
+    FloatP eval(Vector2fP pos, const PreparedParams<Leading> &prepared,
+                const FloatP *param = nullptr) const {
+        FloatP param_weight[2 * ArraySize];
+        uint32_t single_slice;
+        UInt32P slice_offset = interpolate_params(prepared, param, param_weight, single_slice);
+
+        /* Compute linear interpolation weights */
+        pos.x() *= m_inv_patch_size.x();
+        pos.y() *= m_inv_patch_size.y();
+        UInt32P offset_x = min(UInt32P(pos.x()), m_size.x() - 2u),
+                offset_y = min(UInt32P(pos.y()), m_size.y() - 2u);
+
+        FloatP w1_x = pos.x() - FloatP(offset_x),
+               w1_y = pos.y() - FloatP(offset_y),
+               w0_x = 1.f - w1_x,
+               w0_y = 1.f - w1_y;
+
+        UInt32P index = offset_x + offset_y * m_size.x();
+
+        uint32_t size = hprod(m_size);
+        if (Dimension != 0)
+            index += slice_offset * size;
+
+        FloatP v00 = lookup<Dimension>(m_data.data(), index, size,
+                                       param_weight, single_slice),
+               v10 = lookup<Dimension>(m_data.data() + 1, index, size,
+                                       param_weight, single_slice),
+               v01 = lookup<Dimension>(m_data.data() + m_size.x(), index, size,
+                                       param_weight, single_slice),
+               v11 = lookup<Dimension>(m_data.data() + m_size.x() + 1, index, size,
+                                       param_weight, single_slice);
+
+        return fma(w0_y, fma(w0_x, v00, w1_x * v10),
+                         w1_y * fma(w0_x, v01, w1_x * v11)) *
+               FloatP(m_eval_scale);
     }
 
 private:
+        /// Offset of the first slice used to interpolate \c prepared
+        uint32_t slice_offset(const Prepared &prepared) const {
+            uint32_t slice_offset = 0u;
+            for (size_t dim = 0; dim < Dimension; ++dim)
+                slice_offset += m_param_strides[dim] * prepared.index[dim];
+            return slice_offset;
+        }
+
+        /**
+         * Look up parameter-related indices and weights of a packet (if
+         * Dimension != 0), the first \c Leading ones are taken from \c prepared.
+         *
+         * Bit \c i of \c single_slice is set when parameter \c i matches a
+         * discretized value in all lanes, its lookups then read a single slice.
+         */
+        template <size_t Leading>
+        UInt32P interpolate_params(const PreparedParams<Leading> &prepared,
+                                   const FloatP *param, FloatP *param_weight,
+                                   uint32_t &single_slice) const {
+            static_assert(Leading <= Dimension, "Too many leading parameters");
+            uint32_t leading_offset = 0u;
+            for (size_t dim = 0; dim < Leading; ++dim) {
+                param_weight[2 * dim] = prepared.weight[2 * dim];
+                param_weight[2 * dim + 1] = prepared.weight[2 * dim + 1];
+                leading_offset += m_param_strides[dim] * prepared.index[dim];
+            }
+
+            UInt32P slice_offset(leading_offset);
+            for (size_t dim = Leading; dim < Dimension; ++dim) {
+                if (m_param_size[dim] == 1) {
+                    param_weight[2 * dim] = 1.f;
+                    param_weight[2 * dim + 1] = 0.f;
+                    continue;
+                }
+
+                /* All lanes often share the same parameter value (e.g. the
+                   incident direction), a single search then suffices */
+                bool uniform = true;
+                for (size_t i = 1; i < PacketSize; ++i)
+                    uniform &= param[dim][i] == param[dim][0];
+
+                UInt32P param_index;
+                if (uniform) {
+                    param_index = UInt32P((uint32_t) find_interval(
+                        m_param_size[dim],
+                        [&](uint32_t idx) {
+                            return m_param_values[dim][idx] <= param[dim][0];
+                        }
+                    ));
+                } else {
+                    param_index = find_interval_packet(
+                        m_param_size[dim],
+                        [&](const UInt32P &idx) {
+                            return gather(m_param_values[dim].data(), idx) <= param[dim];
+                        }
+                    );
+                }
+
+                FloatP p0 = gather(m_param_values[dim].data(), param_index),
+                       p1 = gather(m_param_values[dim].data(), param_index + 1u);
+
+                param_weight[2 * dim + 1] =
+                    clamp((param[dim] - p0) / (p1 - p0), 0.f, 1.f);
+                param_weight[2 * dim] = 1.f - param_weight[2 * dim + 1];
+                slice_offset += param_index * m_param_strides[dim];
+            }
+
+            single_slice = 0u;
+            for (size_t dim = 0; dim < Dimension; ++dim) {
+                if (all(param_weight[2 * dim + 1] == 0.f)) {
+                    single_slice |= 1u << dim;
+                } else if (all(param_weight[2 * dim] == 0.f)) {
+                    /* Start from the upper value instead */
+                    single_slice |= 1u << dim;
+                    slice_offset += m_param_strides[dim];
+                    param_weight[2 * dim] = 1.f;
+                    param_weight[2 * dim + 1] = 0.f;
+                }
+            }
+            return slice_offset;
+        }
+
+        /// Gather-based packet variant of \c lookup()
+        template <size_t Dim, typename T, std::enable_if_t<Dim != 0, int> = 0>
+        FloatP lookup(const T *data, const UInt32P &i0, uint32_t size,
+                      const FloatP *param_weight, uint32_t single_slice) const {
+            UInt32P i1 = i0 + m_param_strides[Dim - 1] * size;
+
+            /* Parameters matching a discretized value in all lanes (e.g. the
+               wavelengths of the spectra) only need a single slice */
+            if (single_slice & (1u << (Dim - 1)))
+                return lookup<Dim - 1>(data, i0, size, param_weight, single_slice);
+
+            FloatP w0 = param_weight[2 * Dim - 2],
+                   w1 = param_weight[2 * Dim - 1],
+                   v0 = lookup<Dim - 1>(data, i0, size, param_weight, single_slice),
+                   v1 = lookup<Dim - 1>(data, i1, size, param_weight, single_slice);
+
+            return fma(v0, w0, v1 * w1);
+        }
+
+        template <size_t Dim, typename T, std::enable_if_t<Dim == 0, int> = 0>
+        FloatP lookup(const T *data, const UInt32P &index, uint32_t,
+                      const FloatP *, uint32_t) const {
+            return gather(data, index);
+        }
+
+        /// Half precision packet variant, accumulates in the same order as the scalar one
         template <size_t Dim, std::enable_if_t<Dim != 0, int> = 0>
-         float lookup(const float *data, uint32_t i0,
+        FloatP lookup(const Half *data, const UInt32P &i0, uint32_t size,
+                      const FloatP *param_weight, uint32_t single_slice) const {
+            FloatP result(0.f);
+            accumulate_corners<Dim>(data, i0, size, param_weight, single_slice,
+                                    FloatP(1.f), result);
+            return result;
+        }
+
+        template <size_t Dim>
+        void accumulate_corners(const Half *data, const UInt32P &i0, uint32_t size,
+                                const FloatP *param_weight, uint32_t single_slice,
+                                const FloatP &weight, FloatP &result) const {
+            if constexpr (Dim == 0) {
+                result = fma(gather(data, i0), weight, result);
+            } else {
+                /* The second slice has a zero weight, it doesn't contribute */
+                bool single = single_slice & (1u << (Dim - 1));
+                UInt32P i1 = i0 + m_param_strides[Dim - 1] * size;
+                accumulate_corners<Dim - 1>(data, i0, size, param_weight, single_slice,
+                                            weight * param_weight[2 * Dim - 2], result);
+                if (!single)
+                    accumulate_corners<Dim - 1>(data, i1, size, param_weight, single_slice,
+                                                weight * param_weight[2 * Dim - 1], result);
+            }
+        }
+
+        template <size_t Dim, typename T, std::enable_if_t<Dim != 0, int> = 0>
+         float lookup(const T *data, uint32_t i0,
                       uint32_t size, const float *param_weight) const {
             uint32_t i1 = i0 + m_param_strides[Dim - 1] * size;
 
@@ -600,10 +1243,48 @@ private:
             return fma(v0, w0, v1 * w1);
         }
 
-        template <size_t Dim, std::enable_if_t<Dim == 0, int> = 0>
-        float lookup(const float *data, uint32_t index, uint32_t,
+        template <size_t Dim, typename T, std::enable_if_t<Dim == 0, int> = 0>
+        float lookup(const T *data, uint32_t index, uint32_t,
                      const float *) const {
-            return data[index];
+            return to_float(data[index]);
+        }
+
+        /**
+         * Half precision variant: gathers the 2^Dim values to interpolate
+         * first, so that they are converted to single precision at once
+         */
+        template <size_t Dim, std::enable_if_t<Dim != 0, int> = 0>
+        float lookup(const Half *data, uint32_t i0,
+                     uint32_t size, const float *param_weight) const {
+            constexpr size_t Count = size_t(1) << Dim;
+            uint16_t bits[Count];
+            float weights[Count], values[Count];
+
+            uint16_t *bits_out = bits;
+            float *weights_out = weights;
+            gather_corners<Dim>(data, i0, size, param_weight, 1.f, bits_out, weights_out);
+            to_float(bits, values, Count);
+
+            float result = 0.f;
+            for (size_t k = 0; k < Count; ++k)
+                result = fma(values[k], weights[k], result);
+            return result;
+        }
+
+        template <size_t Dim>
+        void gather_corners(const Half *data, uint32_t i0, uint32_t size,
+                    const float *param_weight, float weight,
+                    uint16_t *&bits_out, float *&weights_out) const {
+            if constexpr (Dim == 0) {
+                *bits_out++ = data[i0].bits;
+                *weights_out++ = weight;
+            } else {
+                uint32_t i1 = i0 + m_param_strides[Dim - 1] * size;
+                gather_corners<Dim - 1>(data, i0, size, param_weight,
+                                weight * param_weight[2 * Dim - 2], bits_out, weights_out);
+                gather_corners<Dim - 1>(data, i1, size, param_weight,
+                                weight * param_weight[2 * Dim - 1], bits_out, weights_out);
+            }
         }
 
     private:
@@ -613,6 +1294,9 @@ private:
         /// Size of a bilinear patch in the unit square
         Vector2f m_patch_size, m_inv_patch_size;
 
+        /// Factor applied to interpolated density values in \c eval()
+        float m_eval_scale;
+
         /// Resolution of each parameter (optional)
         uint32_t m_param_size[ArraySize];
 
@@ -623,7 +1307,7 @@ private:
         FloatStorage m_param_values[ArraySize];
 
         /// Density values
-        FloatStorage m_data;
+        ValueStorage m_data;
 
         /// Marginal and conditional PDFs
         FloatStorage m_marginal_cdf;
@@ -633,6 +1317,7 @@ private:
 using Warp2D0 = Marginal2D<0>;
 using Warp2D2 = Marginal2D<2>;
 using Warp2D3 = Marginal2D<3>;
+using Warp2D3h = Marginal2D<3, Half>;
 
 // *****************************************************************************
 // Tensor file I/O
@@ -665,11 +1350,14 @@ public:
         /// Specifies both rank and size along each dimension
         std::vector<size_t> shape;
 
-        /// Pointer to the start of the tensor
-        std::unique_ptr<uint8_t[]> data;
+        /// Pointer to the start of the tensor (points into the file mapping)
+        const uint8_t *data;
+
+        /// Keeps \c data alive, can be shared with data structures referring to it
+        std::shared_ptr<const void> owner;
     };
 
-    /// Load a tensor file into memory
+    /// Map a tensor file into memory
     Tensor(const std::string &filename);
 
     /// Does the file contain a field of the specified name?
@@ -688,6 +1376,29 @@ public:
     std::string filename() const { return m_filename; }
 
 private:
+    /// Read-only view of a whole file, memory mapped when the platform allows it
+    class Mapping {
+    public:
+        Mapping(const std::string &filename);
+        ~Mapping();
+
+        Mapping(const Mapping &) = delete;
+        Mapping &operator=(const Mapping &) = delete;
+
+        const uint8_t *data() const { return m_data; }
+        size_t size() const { return m_size; }
+
+    private:
+        const uint8_t *m_data = nullptr;
+        size_t m_size = 0;
+#if defined(_WIN32)
+        HANDLE m_file = INVALID_HANDLE_VALUE;
+        HANDLE m_mapping = NULL;
+#elif defined(EMSCRIPTEN)
+        std::unique_ptr<uint8_t[]> m_buffer;
+#endif
+    };
+
     std::unordered_map<std::string, Field> m_fields;
     std::string m_filename;
     size_t m_size;
@@ -730,32 +1441,126 @@ static size_t type_size(Tensor::Type value) {
     }
 }
 
-Tensor::Tensor(const std::string &filename) : m_filename(filename) {
-    // Helpful macros to limit error-handling code duplication
-    #define ASSERT(cond, msg)                              \
-        do {                                               \
-            if (!(cond)) {                                 \
-                fclose(file);                              \
-                throw std::runtime_error("Tensor: " msg);  \
-            }                                              \
-        } while(0)
+#if defined(_WIN32)
 
-    #define SAFE_READ(vars, size, count) \
-        ASSERT(fread(vars, size, count, file) == (count), "Unable to read " #vars ".")
+Tensor::Mapping::Mapping(const std::string &filename) {
+    m_file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                         OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (m_file == INVALID_HANDLE_VALUE)
+        throw std::runtime_error("Unable to open file " + filename);
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(m_file, &file_size)) {
+        CloseHandle(m_file);
+        throw std::runtime_error("Tensor: Unable to query file size.");
+    }
+    m_size = static_cast<size_t>(file_size.QuadPart);
+    if (m_size == 0)
+        return;
+
+    m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (m_mapping != NULL)
+        m_data = (const uint8_t *) MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!m_data) {
+        if (m_mapping != NULL)
+            CloseHandle(m_mapping);
+        CloseHandle(m_file);
+        throw std::runtime_error("Tensor: Unable to map file " + filename);
+    }
+}
+
+Tensor::Mapping::~Mapping() {
+    if (m_data)
+        UnmapViewOfFile(m_data);
+    if (m_mapping != NULL)
+        CloseHandle(m_mapping);
+    if (m_file != INVALID_HANDLE_VALUE)
+        CloseHandle(m_file);
+}
+
+#elif defined(EMSCRIPTEN)
 
+Tensor::Mapping::Mapping(const std::string &filename) {
     FILE *file = fopen(filename.c_str(), "rb");
     if (file == NULL)
         throw std::runtime_error("Unable to open file " + filename);
 
-    ASSERT(!fseek(file, 0, SEEK_END),"Unable to seek to end of file.");
+    long size = -1;
+    if (!fseek(file, 0, SEEK_END))
+        size = ftell(file);
+    if (size == -1) {
+        fclose(file);
+        throw std::runtime_error("Tensor: Unable to tell file cursor position.");
+    }
+    rewind(file);
 
-    long size = ftell(file);
-    ASSERT(size != -1, "Unable to tell file cursor position.");
     m_size = static_cast<size_t>(size);
-    rewind(file);
+    m_buffer = std::unique_ptr<uint8_t[]>(new uint8_t[m_size]);
+    size_t read = fread(m_buffer.get(), 1, m_size, file);
+    fclose(file);
+    if (read != m_size)
+        throw std::runtime_error("Tensor: Unable to read file " + filename);
+    m_data = m_buffer.get();
+}
+
+Tensor::Mapping::~Mapping() { }
+
+#else
+
+Tensor::Mapping::Mapping(const std::string &filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd == -1)
+        throw std::runtime_error("Unable to open file " + filename);
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == -1) {
+        close(fd);
+        throw std::runtime_error("Tensor: Unable to query file size.");
+    }
+    m_size = static_cast<size_t>(file_stat.st_size);
+    if (m_size == 0) {
+        close(fd);
+        return;
+    }
+
+    void *data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);              // the mapping keeps its own reference to the file
+    if (data == MAP_FAILED)
+        throw std::runtime_error("Tensor: Unable to map file " + filename);
+    m_data = (const uint8_t *) data;
+}
+
+Tensor::Mapping::~Mapping() {
+    if (m_data)
+        munmap((void *) m_data, m_size);
+}
+
+#endif
+
+Tensor::Tensor(const std::string &filename) : m_filename(filename) {
+    // Helpful macros to limit error-handling code duplication
+    #define ASSERT(cond, msg)                              \
+        do {                                               \
+            if (!(cond))                                   \
+                throw std::runtime_error("Tensor: " msg);  \
+        } while(0)
+
+    #define SAFE_READ(vars, size, count)                                    \
+        do {                                                                \
+            ASSERT((size_t) (end - ptr) >= (size_t) (size) * (count),       \
+                   "Unable to read " #vars ".");                            \
+            memcpy(vars, ptr, (size_t) (size) * (count));                   \
+            ptr += (size_t) (size) * (count);                               \
+        } while(0)
+
+    auto mapping = std::make_shared<const Mapping>(filename);
+    m_size = mapping->size();
 
     ASSERT(m_size >= 12 + 2 + 4, "Invalid tensor file: too small, truncated?");
 
+    const uint8_t *ptr = mapping->data(),
+                  *end = mapping->data() + m_size;
+
     uint8_t header[12], version[2];
     uint32_t n_fields;
     SAFE_READ(header, sizeof(*header), 12);
@@ -787,20 +1592,25 @@ Tensor::Tensor(const std::string &filename) : m_filename(filename) {
             total_size *= shape[j];
         }
 
-        auto data = std::unique_ptr<uint8_t[]>(new uint8_t[total_size]);
-
-        long cur_pos = ftell(file);
-        ASSERT(cur_pos != -1, "Unable to tell current cursor position.");
-        ASSERT(fseek(file, offset, SEEK_SET) != -1, "Unable to seek to tensor offset.");
-        SAFE_READ(data.get(), 1, total_size);
-        ASSERT(fseek(file, cur_pos, SEEK_SET) != -1, "Unable to seek back to current position");
+        ASSERT(offset <= m_size && total_size <= m_size - offset,
+               "Invalid tensor file: field data out of bounds, truncated?");
+
+        /* Fields are views into the mapping, unless they aren't suitably
+           aligned to be accessed in place */
+        const uint8_t *data = mapping->data() + offset;
+        std::shared_ptr<const void> owner = mapping;
+        if ((uintptr_t) data % type_size((Type) dtype) != 0) {
+            auto copy = std::shared_ptr<uint8_t>(new uint8_t[total_size],
+                                                 std::default_delete<uint8_t[]>());
+            memcpy(copy.get(), data, total_size);
+            data = copy.get();
+            owner = std::move(copy);
+        }
 
         m_fields[name] =
-            Field{ (Type) dtype, static_cast<size_t>(offset), shape, std::move(data) };
+            Field{ (Type) dtype, static_cast<size_t>(offset), shape, data, std::move(owner) };
     }
 
-    fclose(file);
-
     #undef SAFE_READ
     #undef ASSERT
 }
@@ -864,9 +1674,76 @@ struct BRDF::Data {
     Warp2D2 vndf;
     Warp2D2 luminance, rgb[3];
     Warp2D3 spectra;
+    Warp2D3h spectra_half;      // replaces 'spectra' when stored in half precision
+    bool half_spectra;
     Spectrum wavelengths;
+    std::string description;
     bool isotropic;
     bool jacobian;
+
+    /// Interpolation of the incident angle parameters, shared by vndf, luminance,
+    /// rgb and the spectra (which all use the same discretization)
+    PreparedParams<2> prepare(const float *params) const {
+        return vndf.prepare(params);
+    }
+
+    /// Interpolation of the spectra parameters at the tabulated wavelength
+    /// \c index, which needs no search
+    PreparedParams<3> prepare_wavelength(const PreparedParams<2> &incident,
+                                         size_t index) const {
+        PreparedParams<3> prepared;
+        for (size_t dim = 0; dim < 2; ++dim) {
+            prepared.index[dim] = incident.index[dim];
+            prepared.weight[2 * dim] = incident.weight[2 * dim];
+            prepared.weight[2 * dim + 1] = incident.weight[2 * dim + 1];
+        }
+
+        /* Same index and weights as a search would produce (the last
+           wavelength is the upper end of the last interval) */
+        bool last = index + 1 == wavelengths.size() && index > 0;
+        prepared.index[2] = (uint32_t) (last ? index - 1 : index);
+        prepared.weight[4] = last ? 0.f : 1.f;
+        prepared.weight[5] = last ? 1.f : 0.f;
+        return prepared;
+    }
+
+    /// Evaluate the spectra at \c pos, the parameters that were not
+    /// interpolated by \c prepared are read from \c param
+    template <size_t Leading>
+    FloatP eval_spectra(const Vector2fP &pos, const PreparedParams<Leading> &prepared,
+                        const FloatP *param = nullptr) const {
+        return half_spectra ? spectra_half.eval(pos, prepared, param)
+                            : spectra.eval(pos, prepared, param);
+    }
+
+    /// Evaluate the spectra at \c pos for all the (selected) wavelengths at once
+    void eval_spectrum(const Vector2f &pos, const PreparedParams<2> &incident,
+                       float *out, const WavelengthMask *mask = nullptr) const {
+        Vector2fP pos_p(FloatP(pos.x()), FloatP(pos.y()));
+        FloatP params_p[3];
+        size_t indices[PacketSize], count = 0;
+
+        /* The selected wavelengths are evaluated by packets (the last one
+           repeats its last wavelength to fill its lanes) */
+        auto eval_packet = [&]() {
+            for (size_t l = 0; l < PacketSize; ++l)
+                params_p[2][l] = wavelengths[indices[std::min(l, count - 1)]];
+            FloatP values = eval_spectra(pos_p, incident, params_p);
+            for (size_t l = 0; l < count; ++l)
+                out[indices[l]] = values[l];
+            count = 0;
+        };
+
+        for (size_t i = 0; i < wavelengths.size(); ++i) {
+            if (mask && !(*mask)[i])
+                continue;
+            indices[count++] = i;
+            if (count == PacketSize)
+                eval_packet();
+        }
+        if (count > 0)
+            eval_packet();
+    }
 };
 
 // *****************************************************************************
@@ -889,6 +1766,15 @@ template <typename Value> Value phi2u(Value phi) {
     return (phi + Pi) / (2.f * Pi);
 }
 
+/// Calls \c f with the index of each wavelength selected by \c mask (all if null)
+template <typename Func>
+void for_each_wavelength(size_t n, const WavelengthMask *mask, Func f) {
+    for (size_t i = 0; i < n; ++i) {
+        if (!mask || (*mask)[i])
+            f(i);
+    }
+}
+
 Spectrum BRDF::zero() const {
     return Spectrum(0.f, m_data->wavelengths.size());
 }
@@ -897,19 +1783,32 @@ const Spectrum &BRDF::wavelengths() const {
     return m_data->wavelengths;
 }
 
+size_t BRDF::n_wavelengths() const {
+    return m_data->wavelengths.size();
+}
+
+bool BRDF::isotropic() const {
+    return m_data->isotropic;
+}
+
 // *****************************************************************************
 // Ctor/dtor
 // *****************************************************************************
 
-BRDF::BRDF(const std::string &path_to_file)
-:   m_theta_n(0)
-,   m_phi_n(0)
-,   m_n_points(0)
-,   m_wi(0.0f)
-,   m_params{0, 0}
-{
+std::shared_ptr<const BRDF::Data> BRDF::read_data(const std::string &path_to_file,
+                                                   bool half_precision,
+                                                   Timings &timings) {
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point stage_start = Clock::now();
+    auto end_stage = [&](const char *name) {
+        Clock::time_point now = Clock::now();
+        timings.emplace_back(name,
+            std::chrono::duration<double, std::micro>(now - stage_start).count());
+        stage_start = now;
+    };
 
     Tensor tf = Tensor(path_to_file);
+    end_stage("Mapping tensor file");
     auto& theta_i = tf.field("theta_i");
     auto& phi_i = tf.field("phi_i");
     auto& ndf = tf.field("ndf");
@@ -945,12 +1844,12 @@ BRDF::BRDF(const std::string &path_to_file)
           vndf.shape[1] == theta_i.shape[0] &&
 
           luminance.shape.size() == 4 &&
-          luminance.dtype == Tensor::Float32 &&
+          (luminance.dtype == Tensor::Float32 || luminance.dtype == Tensor::Float16) &&
           luminance.shape[0] == phi_i.shape[0] &&
           luminance.shape[1] == theta_i.shape[0] &&
           luminance.shape[2] == luminance.shape[3] &&
 
-          spectra.dtype == Tensor::Float32 &&
+          (spectra.dtype == Tensor::Float32 || spectra.dtype == Tensor::Float16) &&
           spectra.shape.size() == 5 &&
           spectra.shape[0] == phi_i.shape[0] &&
           spectra.shape[1] == theta_i.shape[0] &&
@@ -965,61 +1864,67 @@ BRDF::BRDF(const std::string &path_to_file)
           jacobian.dtype == Tensor::UInt8))
             throw std::runtime_error("Invalid file structure: " + tf.to_string());
 
-    m_data = std::unique_ptr<BRDF::Data>(new BRDF::Data());
+    auto data = std::make_shared<BRDF::Data>();
 
-    m_data->isotropic = phi_i.shape[0] <= 2;
-    m_data->jacobian  = ((uint8_t *) jacobian.data.get())[0];
+    data->isotropic = phi_i.shape[0] <= 2;
+    data->jacobian  = ((const uint8_t *) jacobian.data)[0];
 
-    if (!m_data->isotropic) {
-        float *phi_i_data = (float *) phi_i.data.get();
+    if (!data->isotropic) {
+        const float *phi_i_data = (const float *) phi_i.data;
         int reduction = (int) std::rint((2 * Pi) /
             (phi_i_data[phi_i.shape[0] - 1] - phi_i_data[0]));
         if (reduction != 1)
             throw std::runtime_error("reduction != 1, not supported by this implementation");
     }
 
-    /* Construct NDF interpolant data structure */
-    m_data->ndf = Warp2D0(
+    /* Construct NDF interpolant data structure (refers to the mapped file) */
+    data->ndf = Warp2D0(
         Vector2u(ndf.shape[1], ndf.shape[0]),
-        (float *) ndf.data.get(),
-        { }, { }, false, false
+        (const float *) ndf.data,
+        { }, { }, false, false, ndf.owner
     );
 
     /* Construct projected surface area interpolant data structure */
-    m_data->sigma = Warp2D0(
+    data->sigma = Warp2D0(
         Vector2u(sigma.shape[1], sigma.shape[0]),
-        (float *) sigma.data.get(),
-        { }, { }, false, false
+        (const float *) sigma.data,
+        { }, { }, false, false, sigma.owner
     );
 
     /* Construct VNDF warp data structure */
-    m_data->vndf = Warp2D2(
+    data->vndf = Warp2D2(
         Vector2u(vndf.shape[3], vndf.shape[2]),
-        (float *) vndf.data.get(),
+        (const float *) vndf.data,
         {{ (uint32_t) phi_i.shape[0],
            (uint32_t) theta_i.shape[0] }},
-        {{ (const float *) phi_i.data.get(),
-           (const float *) theta_i.data.get() }}
+        {{ (const float *) phi_i.data,
+           (const float *) theta_i.data }}
     );
 
-    /* Construct Luminance warp data structure */
-    m_data->luminance = Warp2D2(
-        Vector2u(luminance.shape[3], luminance.shape[2]),
-        (float *) luminance.data.get(),
-        {{ (uint32_t) phi_i.shape[0],
-           (uint32_t) theta_i.shape[0] }},
-        {{ (const float *) phi_i.data.get(),
-           (const float *) theta_i.data.get() }}
-    );
+    /* Construct Luminance warp data structure (half precision values are expanded) */
+    auto luminance_warp = [&](const auto *values) {
+        return Warp2D2(
+            Vector2u(luminance.shape[3], luminance.shape[2]),
+            values,
+            {{ (uint32_t) phi_i.shape[0],
+               (uint32_t) theta_i.shape[0] }},
+            {{ (const float *) phi_i.data,
+               (const float *) theta_i.data }}
+        );
+    };
+    data->luminance = luminance.dtype == Tensor::Float16
+        ? luminance_warp((const Half *) luminance.data)
+        : luminance_warp((const float *) luminance.data);
+    end_stage("Building ndf, vndf and luminance warps");
 
     /* Copy wavelength information */
     size_t size = wavelengths.shape[0];
-    m_data->wavelengths.resize(size);
+    data->wavelengths.resize(size);
     std::vector<Vector3f> rgb_weights(size);
 
     for (size_t k = 0; k < size; ++k) {
-        float lambda = ((const float *) wavelengths.data.get())[k];
-        m_data->wavelengths[k] = lambda;
+        float lambda = ((const float *) wavelengths.data)[k];
+        data->wavelengths[k] = lambda;
 
         Vector3f XYZ =
             Vector3f(cie_interp(cie_x, lambda), cie_interp(cie_y, lambda),
@@ -1035,56 +1940,154 @@ BRDF::BRDF(const std::string &path_to_file)
     }
 
     size_t n_slices = spectra.shape[0] * spectra.shape[1];
+    size_t n_wavelengths = spectra.shape[2];
     size_t slice_size = spectra.shape[3] * spectra.shape[4];
 
-    std::vector<float> rgb[3];
-    float* out_ptr[3];
-    for (int i = 0; i < 3; ++i) {
-        rgb[i].resize(n_slices * slice_size, 0.f);
-        out_ptr[i] = rgb[i].data();
-    }
-
-    const float *in_ptr = (const float *) spectra.data.get();
+    /* The warps take over the rgb tables instead of copying them */
+    std::shared_ptr<std::vector<float>> rgb[3];
+    for (int i = 0; i < 3; ++i)
+        rgb[i] = std::make_shared<std::vector<float>>(n_slices * slice_size, 0.f);
+
+    /* Project the spectra on the rgb primaries: the 3 x n_wavelengths weight
+       matrix is applied to each slice (in parallel), one tile of values at a
+       time so that the three accumulators stay in cache */
+    constexpr size_t RGB_TILE_SIZE = 1024;
+    auto project_spectra = [&](const auto *spectra_data) {
+        parallel_for(0, n_slices, [&](size_t slice) {
+            float tile[RGB_TILE_SIZE];
+            for (size_t j0 = 0; j0 < slice_size; j0 += RGB_TILE_SIZE) {
+                size_t count = std::min(RGB_TILE_SIZE, slice_size - j0);
+                size_t out_offset = slice * slice_size + j0;
+                float *out_r = rgb[0]->data() + out_offset,
+                      *out_g = rgb[1]->data() + out_offset,
+                      *out_b = rgb[2]->data() + out_offset;
+
+                for (size_t k = 0; k < n_wavelengths; ++k) {
+                    const auto *in = spectra_data +
+                        (slice * n_wavelengths + k) * slice_size + j0;
+                    const float *values;
+                    if constexpr (std::is_same<std::decay_t<decltype(*in)>, Half>::value) {
+                        to_float((const uint16_t *) in, tile, count);
+                        values = tile;
+                    } else {
+                        values = in;
+                    }
 
-    for (uint32_t i = 0; i < n_slices ; ++i) {
-        for (uint32_t k = 0; k < spectra.shape[2]; ++k) {
-            Vector3f weight = rgb_weights[k];
-            for (uint32_t j = 0; j < slice_size; ++j) {
-                float in_value = *in_ptr++;
-                for (int l = 0; l < 3; ++l)
-                    out_ptr[l][j] += weight[l] * in_value;
+                    float w_r = rgb_weights[k][0],
+                          w_g = rgb_weights[k][1],
+                          w_b = rgb_weights[k][2];
+                    for (size_t j = 0; j < count; ++j) {
+                        float value = values[j];
+                        out_r[j] += w_r * value;
+                        out_g[j] += w_g * value;
+                        out_b[j] += w_b * value;
+                    }
+                }
             }
-        }
-        for (int l = 0; l < 3; ++l)
-            out_ptr[l] += slice_size;
-    }
+        });
+    };
+    if (spectra.dtype == Tensor::Float16)
+        project_spectra((const Half *) spectra.data);
+    else
+        project_spectra((const float *) spectra.data);
 
     for (int i = 0; i < 3; ++i) {
-        m_data->rgb[i] = Warp2D2(
+        data->rgb[i] = Warp2D2(
             Vector2u(luminance.shape[3], luminance.shape[2]),
-            (float *) rgb[i].data(),
+            rgb[i]->data(),
             { { (uint32_t) phi_i.shape[0], (uint32_t) theta_i.shape[0] } },
-            { { (const float *) phi_i.data.get(),
-                (const float *) theta_i.data.get() } },
-            false, false);
+            { { (const float *) phi_i.data,
+                (const float *) theta_i.data } },
+            false, false, rgb[i]);
+    }
+    end_stage("Projecting spectra to rgb");
+
+    /* Construct spectral interpolant (refers to the mapped file, unless the
+       values are converted to half precision) */
+    auto spectra_warp = [&](auto &warp, const auto *values) {
+        using Warp = std::decay_t<decltype(warp)>;
+        warp = Warp(
+            Vector2u(spectra.shape[4], spectra.shape[3]),
+            values,
+            {{ (uint32_t) phi_i.shape[0],
+               (uint32_t) theta_i.shape[0],
+               (uint32_t) wavelengths.shape[0] }},
+            {{ (const float *) phi_i.data,
+               (const float *) theta_i.data,
+               (const float *) wavelengths.data }},
+            false, false, spectra.owner
+        );
+    };
+    data->half_spectra = half_precision || spectra.dtype == Tensor::Float16;
+    if (spectra.dtype == Tensor::Float16)
+        spectra_warp(data->spectra_half, (const Half *) spectra.data);
+    else if (half_precision)
+        spectra_warp(data->spectra_half, (const float *) spectra.data);
+    else
+        spectra_warp(data->spectra, (const float *) spectra.data);
+    end_stage("Building spectral warp");
+
+    data->description = std::string((const char*)description.data, description.shape[0]);
+
+    return data;
+}
+
+std::shared_ptr<const BRDF::Data> BRDF::load_data(const std::string &path_to_file,
+                                                   bool half_precision,
+                                                   Timings &timings) {
+    /* Files are identified by their canonical path and modification time, so
+       that a file modified on disk is read again */
+    std::error_code error;
+    std::filesystem::path path = std::filesystem::canonical(path_to_file, error);
+    if (error)
+        path = path_to_file;
+    auto mtime = std::filesystem::last_write_time(path, error);
+    std::string key = path.string() + '@' +
+        std::to_string(error ? 0 : (long long) mtime.time_since_epoch().count()) +
+        (half_precision ? "/f16" : "/f32");
+
+    static std::mutex cache_mutex;
+    static std::unordered_map<std::string, std::weak_ptr<const Data>> cache;
+
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        auto it = cache.find(key);
+        if (it != cache.end())
+            if (auto data = it->second.lock())
+                return data;
     }
 
-    /* Construct spectral interpolant */
-    m_data->spectra = Warp2D3(
-        Vector2u(spectra.shape[4], spectra.shape[3]),
-        (float *) spectra.data.get(),
-        {{ (uint32_t) phi_i.shape[0],
-           (uint32_t) theta_i.shape[0],
-           (uint32_t) wavelengths.shape[0] }},
-        {{ (const float *) phi_i.data.get(),
-           (const float *) theta_i.data.get(),
-           (const float *) wavelengths.data.get() }},
-        false, false
-    );
+    /* Read the file without holding the lock, other files can be opened meanwhile */
+    std::shared_ptr<const Data> data = read_data(path_to_file, half_precision, timings);
 
-    m_description = std::string((char*)description.data.get(), description.shape[0]);
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    for (auto it = cache.begin(); it != cache.end();) {
+        if (it->second.expired())
+            it = cache.erase(it);
+        else
+            ++it;
+    }
+    /* Keep the first copy if the same file was read concurrently (and is
+       still alive, its last owner may have released it since the sweep) */
+    auto inserted = cache.emplace(key, data);
+    if (!inserted.second) {
+        if (auto existing = inserted.first->second.lock())
+            return existing;
+        inserted.first->second = data;
+    }
+    return data;
 }
 
+BRDF::BRDF(const std::string &path_to_file, bool half_precision)
+:   m_data(load_data(path_to_file, half_precision, m_load_timings))
+,   m_description(m_data->description)
+,   m_theta_n(0)
+,   m_phi_n(0)
+,   m_n_points(0)
+,   m_wi(0.0f)
+,   m_params{0, 0}
+{ }
+
 BRDF::~BRDF() { }
 
 /// Numerically more robust way of evaluating 'std::acos(d.z())'
@@ -1117,11 +2120,12 @@ float BRDF::pdf(const Vector3f &wi, const Vector3f &wo) const {
 
     Vector2f sample;
     float vndf_pdf, params[2] = { phi_i, theta_i };
-    std::tie(sample, vndf_pdf) = m_data->vndf.invert(u_wm, params);
+    PreparedParams<2> prepared = m_data->prepare(params);
+    std::tie(sample, vndf_pdf) = m_data->vndf.invert(u_wm, prepared);
 
     float pdf = 1.f;
     #if POWITACQ_SAMPLE_LUMINANCE
-        pdf = m_data->luminance.eval(sample, params);
+        pdf = m_data->luminance.eval(sample, prepared);
     #endif
 
     float sin_theta_m = std::sqrt(sqr(wm.x()) + sqr(wm.y()));
@@ -1136,8 +2140,30 @@ float BRDF::pdf(const Vector3f &wi, const Vector3f &wo) const {
 // *****************************************************************************
 
 Spectrum BRDF::eval(const Vector3f &wi, const Vector3f &wo) const {
+    Spectrum fr = zero();
+    eval(wi, wo, &fr[0]);
+    return fr;
+}
+
+void BRDF::eval(const Vector3f &wi, const Vector3f &wo, float *out,
+                const WavelengthMask *mask) const {
+    size_t n = n_wavelengths();
+    Vector2f sample;
+    PreparedParams<2> prepared;
+    float scale;
+    if (!lookup(wi, wo, sample, prepared, scale)) {
+        for_each_wavelength(n, mask, [&](size_t i) { out[i] = 0.f; });
+        return;
+    }
+
+    m_data->eval_spectrum(sample, prepared, out, mask);
+    for_each_wavelength(n, mask, [&](size_t i) { out[i] *= scale; });
+}
+
+bool BRDF::lookup(const Vector3f &wi, const Vector3f &wo, Vector2f &sample,
+                  PreparedParams<2> &prepared, float &scale) const {
     if (wi.z() <= 0 || wo.z() <= 0)
-        return zero();
+        return false;
 
     Vector3f wm = normalize(wi + wo);
 
@@ -1155,21 +2181,12 @@ Spectrum BRDF::eval(const Vector3f &wi, const Vector3f &wo) const {
     );
     u_wm.y() = u_wm.y() - std::floor(u_wm.y());
 
-    Vector2f sample;
     float vndf_pdf, params[2] = { phi_i, theta_i };
-    std::tie(sample, vndf_pdf) = m_data->vndf.invert(u_wm, params);
+    prepared = m_data->prepare(params);
+    std::tie(sample, vndf_pdf) = m_data->vndf.invert(u_wm, prepared);
 
-    Spectrum fr = zero();
-    for (int i = 0; i < (int) m_data->wavelengths.size(); ++i) {
-        float params_fr[3] = { phi_i, theta_i, m_data->wavelengths[i] };
-
-        fr[i] = m_data->spectra.eval(sample, params_fr);
-    }
-
-    fr *= m_data->ndf.eval(u_wm, params) /
-            (4 * m_data->sigma.eval(u_wi, params));
-
-    return fr;
+    scale = m_data->ndf.eval(u_wm) / (4 * m_data->sigma.eval(u_wi));
+    return true;
 }
 
 // *****************************************************************************
@@ -1178,31 +2195,42 @@ Spectrum BRDF::eval(const Vector3f &wi, const Vector3f &wo) const {
 
 Spectrum BRDF::sample(const Vector2f &u, const Vector3f &wi,
                       Vector3f *wo_out, float *pdf_out) const {
+    Spectrum fr = zero();
+    sample(u, wi, &fr[0], wo_out, pdf_out);
+    return fr;
+}
+
+void BRDF::sample(const Vector2f &u, const Vector3f &wi, float *out,
+                  Vector3f *wo_out, float *pdf_out,
+                  const WavelengthMask *mask) const {
+    size_t n = n_wavelengths();
     if (wi.z() <= 0) {
         if (wo_out)
             *wo_out = Vector3f(0.f);
         if (pdf_out)
             *pdf_out = 0;
-        return zero();
+        for_each_wavelength(n, mask, [&](size_t i) { out[i] = 0.f; });
+        return;
     }
 
     float theta_i = elevation(wi),
           phi_i   = std::atan2(wi.y(), wi.x());
 
     float params[2] = { phi_i, theta_i };
+    PreparedParams<2> prepared = m_data->prepare(params);
     Vector2f u_wi = Vector2f(theta2u(theta_i), phi2u(phi_i));
     Vector2f sample = Vector2f(u.y(), u.x());
     float lum_pdf = 1.f;
 
     #if POWITACQ_SAMPLE_LUMINANCE
         std::tie(sample, lum_pdf) =
-            m_data->luminance.sample(sample, params);
+            m_data->luminance.sample(sample, prepared);
     #endif
 
     Vector2f u_wm;
     float ndf_pdf;
     std::tie(u_wm, ndf_pdf) =
-        m_data->vndf.sample(sample, params);
+        m_data->vndf.sample(sample, prepared);
 
     float phi_m   = u2phi(u_wm.y()),
           theta_m = u2theta(u_wm.x());
@@ -1228,18 +2256,13 @@ Spectrum BRDF::sample(const Vector2f &u, const Vector3f &wi,
             *wo_out = Vector3f(0.f);
         if (pdf_out)
             *pdf_out = 0;
-        return zero();
+        for_each_wavelength(n, mask, [&](size_t i) { out[i] = 0.f; });
+        return;
     }
 
-    Spectrum fr = zero();
-    for (int i = 0; i < (int) m_data->wavelengths.size(); ++i) {
-        float params_fr[3] = { phi_i, theta_i, m_data->wavelengths[i] };
-
-        fr[i] = m_data->spectra.eval(sample, params_fr);
-    }
+    m_data->eval_spectrum(sample, prepared, out, mask);
 
-    fr *= m_data->ndf.eval(u_wm, params) /
-            (4 * m_data->sigma.eval(u_wi, params));
+    float scale = m_data->ndf.eval(u_wm) / (4 * m_data->sigma.eval(u_wi));
 
     float jacobian = std::max(2.f * sqr(Pi) * u_wm.x() *
                               sin_theta_m, 1e-6f) * 4.f * dot(wi, wm);
@@ -1249,24 +2272,456 @@ Spectrum BRDF::sample(const Vector2f &u, const Vector3f &wi,
     if (wo_out)  (*wo_out)  = wo;
     if (pdf_out) (*pdf_out) = pdf;
 
-    return fr / pdf;
+    for_each_wavelength(n, mask, [&](size_t i) { out[i] = out[i] * scale / pdf; });
+}
+
+// *****************************************************************************
+// Batch interface
+// *****************************************************************************
+
+// number of directions processed by each task of the batch interface
+static constexpr size_t BATCH_BLOCK = 64;
+
+/* Runs f(j, spectrum) for the directions of each block in parallel, f writing
+   the spectrum of direction j into a block-local buffer that is then copied
+   (transposed) into the rows of out */
+template <typename Func>
+static void run_batch(size_t n, size_t n_wavelengths, const WavelengthMask *mask,
+                      float *out, size_t out_stride, const Func &f) {
+    parallel_for(0, (n + BATCH_BLOCK - 1) / BATCH_BLOCK, [&](size_t block) {
+        size_t first = block * BATCH_BLOCK,
+               count = std::min(BATCH_BLOCK, n - first);
+        std::unique_ptr<float[]> spectra(new float[BATCH_BLOCK * n_wavelengths]);
+
+        for (size_t j = 0; j < count; ++j)
+            f(first + j, spectra.get() + j * n_wavelengths);
+
+        for_each_wavelength(n_wavelengths, mask, [&](size_t i) {
+            float *row = out + i * out_stride + first;
+            for (size_t j = 0; j < count; ++j)
+                row[j] = spectra[j * n_wavelengths + i];
+        });
+    });
+}
+
+void BRDF::eval_batch(size_t n, const Directions &wi, const Directions &wo,
+                      float *out, size_t out_stride,
+                      const WavelengthMask *mask) const {
+    run_batch(n, n_wavelengths(), mask, out, out_stride, [&](size_t j, float *spectrum) {
+        eval(wi[j], wo[j], spectrum, mask);
+    });
+}
+
+void BRDF::eval_rgb_batch(size_t n, const Directions &wi, const Directions &wo,
+                          float *rgb_out, size_t out_stride) const {
+    parallel_for(0, (n + BATCH_BLOCK - 1) / BATCH_BLOCK, [&](size_t block) {
+        size_t first = block * BATCH_BLOCK,
+               last = std::min(first + BATCH_BLOCK, n);
+        for (size_t j = first; j < last; ++j) {
+            Vector2f sample;
+            PreparedParams<2> prepared;
+            float scale;
+            bool valid = lookup(wi[j], wo[j], sample, prepared, scale);
+            for (size_t c = 0; c < 3; ++c)
+                rgb_out[c * out_stride + j] =
+                    valid ? m_data->rgb[c].eval(sample, prepared) * scale : 0.f;
+        }
+    });
+}
+
+void BRDF::sample_batch(size_t n, const float *u1, const float *u2,
+                        const Directions &wi, float *out, size_t out_stride,
+                        DirectionArrays<float> *wo_out, float *pdf_out,
+                        const WavelengthMask *mask) const {
+    run_batch(n, n_wavelengths(), mask, out, out_stride, [&](size_t j, float *spectrum) {
+        Vector3f wo;
+        float pdf;
+        sample(Vector2f(u1[j], u2[j]), wi[j], spectrum, &wo, &pdf, mask);
+        if (wo_out)
+            wo_out->set(j, wo);
+        if (pdf_out)
+            pdf_out[j] = pdf;
+    });
+}
+
+void BRDF::pdf_batch(size_t n, const Directions &wi, const Directions &wo,
+                     float *pdf_out) const {
+    parallel_for(0, (n + BATCH_BLOCK - 1) / BATCH_BLOCK, [&](size_t block) {
+        size_t first = block * BATCH_BLOCK,
+               last = std::min(first + BATCH_BLOCK, n);
+        for (size_t j = first; j < last; ++j)
+            pdf_out[j] = pdf(wi[j], wo[j]);
+    });
+}
+
+// number of samples of a direction integrated by each task of albedo_batch
+static constexpr size_t ALBEDO_BATCH = 256;
+
+/// Van der Corput radical inverse in base 2 (second coordinate of the Hammersley set)
+inline float radical_inverse_2(uint32_t i) {
+    i = (i << 16) | (i >> 16);
+    i = ((i & 0x00ff00ffu) << 8) | ((i & 0xff00ff00u) >> 8);
+    i = ((i & 0x0f0f0f0fu) << 4) | ((i & 0xf0f0f0f0u) >> 4);
+    i = ((i & 0x33333333u) << 2) | ((i & 0xccccccccu) >> 2);
+    i = ((i & 0x55555555u) << 1) | ((i & 0xaaaaaaaau) >> 1);
+    return std::min(float(i) * 0x1p-32f, 1.f - std::numeric_limits<float>::epsilon() / 2);
+}
+
+void BRDF::albedo_batch(size_t n, const Directions &wi, size_t n_samples,
+                        float *out, size_t out_stride,
+                        float *luminance_out) const {
+    size_t n_wavelengths = this->n_wavelengths(),
+           n_batches = std::max<size_t>((n_samples + ALBEDO_BATCH - 1) / ALBEDO_BATCH, 1);
+
+    /* Each task sums the weights of a batch of samples of a direction, the
+       batches are added up in order afterwards (so that the result doesn't
+       depend on the scheduling) */
+    std::vector<float> partial(n * n_batches * n_wavelengths, 0.f);
+    parallel_for(0, n * n_batches, [&](size_t task) {
+        size_t j = task / n_batches,
+               first = (task % n_batches) * ALBEDO_BATCH,
+               last = std::min(first + ALBEDO_BATCH, n_samples);
+        float *sum = &partial[task * n_wavelengths];
+        std::unique_ptr<float[]> weight(new float[n_wavelengths]);
+        Vector3f wi_j = wi[j];
+
+        for (size_t k = first; k < last; ++k) {
+            Vector2f u((k + .5f) / n_samples, radical_inverse_2((uint32_t) k));
+            sample(u, wi_j, weight.get());
+            for (size_t i = 0; i < n_wavelengths; ++i)
+                sum[i] += weight[i];
+        }
+    });
+
+    /* Luminance: average of the spectrum weighted by the CIE Y matching function */
+    std::vector<float> y_weights(n_wavelengths);
+    float y_total = 0.f;
+    for (size_t i = 0; i < n_wavelengths; ++i) {
+        y_weights[i] = cie_interp(cie_y, m_data->wavelengths[i]);
+        y_total += y_weights[i];
+    }
+
+    parallel_for(0, n, [&](size_t j) {
+        float luminance = 0.f;
+        for (size_t i = 0; i < n_wavelengths; ++i) {
+            double total = 0.0;
+            for (size_t batch = 0; batch < n_batches; ++batch)
+                total += partial[((j * n_batches) + batch) * n_wavelengths + i];
+            float albedo = n_samples > 0 ? float(total / n_samples) : 0.f;
+            out[i * out_stride + j] = albedo;
+            luminance += albedo * y_weights[i];
+        }
+        if (luminance_out)
+            luminance_out[j] = y_total > 0 ? luminance / y_total : 0.f;
+    });
+}
+
+// *****************************************************************************
+// Table export
+// *****************************************************************************
+
+// number of points of the table evaluated and written at once by export_table
+static constexpr size_t TABLE_BLOCK = 1 << 14;
+
+void BRDF::export_table(const std::string &path, const TableGrid &grid) const {
+    size_t n_channels = grid.rgb ? 3 : n_wavelengths(),
+           n_points = grid.phi_h_n * grid.theta_h_n * grid.theta_d_n * grid.phi_d_n;
+    if (n_points == 0)
+        throw std::runtime_error("export_table(): empty grid");
+
+    auto axis = [](size_t n, float range) {
+        std::vector<float> angles(n);
+        for (size_t i = 0; i < n; ++i)
+            angles[i] = (i + .5f) * range / n;
+        return angles;
+    };
+    std::vector<float> phi_h   = axis(grid.phi_h_n, 2 * Pi),
+                       theta_h = axis(grid.theta_h_n, .5f * Pi),
+                       theta_d = axis(grid.theta_d_n, .5f * Pi),
+                       phi_d   = axis(grid.phi_d_n, Pi);
+    if (grid.phi_h_n == 1)
+        phi_h[0] = 0.f;
+    const std::string description = m_description;
+
+    /* Header first: the data of the fields follows it, aligned on 64 bytes */
+    struct Field {
+        std::string name;
+        Tensor::Type dtype;
+        std::vector<uint64_t> shape;
+        const void *data;       // written with the header, unless streamed (values)
+        uint64_t offset;
+    };
+    std::vector<Field> fields = {
+        { "phi_h",   Tensor::Float32, { phi_h.size() },   phi_h.data(),   0 },
+        { "theta_h", Tensor::Float32, { theta_h.size() }, theta_h.data(), 0 },
+        { "theta_d", Tensor::Float32, { theta_d.size() }, theta_d.data(), 0 },
+        { "phi_d",   Tensor::Float32, { phi_d.size() },   phi_d.data(),   0 },
+        { "description", Tensor::UInt8, { description.size() }, description.data(), 0 }
+    };
+    if (!grid.rgb)
+        fields.push_back({ "wavelengths", Tensor::Float32, { n_channels }, &m_data->wavelengths[0], 0 });
+    fields.push_back({ "values", Tensor::Float32,
+                       { grid.phi_h_n, grid.theta_h_n, grid.theta_d_n, grid.phi_d_n, n_channels },
+                       nullptr, 0 });
+
+    uint64_t offset = 12 + 2 + 4;
+    for (const Field &field : fields)
+        offset += 2 + field.name.size() + 2 + 1 + 8 + 8 * field.shape.size();
+    for (Field &field : fields) {
+        offset = (offset + 63) / 64 * 64;
+        field.offset = offset;
+        uint64_t size = type_size(field.dtype);
+        for (uint64_t s : field.shape)
+            size *= s;
+        offset += size;
+    }
+
+    std::unique_ptr<FILE, int (*)(FILE *)> file(fopen(path.c_str(), "wb"), &fclose);
+    if (!file)
+        throw std::runtime_error("export_table(): could not open \"" + path + "\"");
+    uint64_t position = 0;
+    auto write = [&](const void *data, size_t size) {
+        if (size > 0 && fwrite(data, 1, size, file.get()) != size)
+            throw std::runtime_error("export_table(): could not write \"" + path + "\"");
+        position += size;
+    };
+    auto pad_to = [&](uint64_t target) {
+        const char zeros[64] = { };
+        while (position < target)
+            write(zeros, (size_t) std::min<uint64_t>(target - position, sizeof(zeros)));
+    };
+
+    const uint8_t version[2] = { 1, 0 };
+    uint32_t n_fields = (uint32_t) fields.size();
+    write("tensor_file", 12);
+    write(version, 2);
+    write(&n_fields, 4);
+    for (const Field &field : fields) {
+        uint16_t name_length = (uint16_t) field.name.size(),
+                 ndim = (uint16_t) field.shape.size();
+        uint8_t dtype = (uint8_t) field.dtype;
+        write(&name_length, 2);
+        write(field.name.data(), name_length);
+        write(&ndim, 2);
+        write(&dtype, 1);
+        write(&field.offset, 8);
+        write(field.shape.data(), 8 * ndim);
+    }
+    for (const Field &field : fields) {
+        if (!field.data)
+            continue;
+        pad_to(field.offset);
+        write(field.data, type_size(field.dtype) * field.shape[0]);
+    }
+    pad_to(fields.back().offset);
+
+    /* Then the values, evaluated in parallel block after block (directions
+       and results as structures of arrays, written interleaved) */
+    size_t block_size = std::min(TABLE_BLOCK, n_points);
+    std::vector<float> wi_data(3 * block_size), wo_data(3 * block_size),
+                       values(n_channels * block_size), interleaved(n_channels * block_size);
+    Directions wi, wo;
+    wi.x = &wi_data[0]; wi.y = &wi_data[block_size]; wi.z = &wi_data[2 * block_size];
+    wo.x = &wo_data[0]; wo.y = &wo_data[block_size]; wo.z = &wo_data[2 * block_size];
+
+    for (size_t first = 0; first < n_points; first += block_size) {
+        size_t count = std::min(block_size, n_points - first);
+
+        parallel_for(0, count, [&](size_t j) {
+            size_t index = first + j;
+            size_t i_phi_d   = index % grid.phi_d_n;   index /= grid.phi_d_n;
+            size_t i_theta_d = index % grid.theta_d_n; index /= grid.theta_d_n;
+            size_t i_theta_h = index % grid.theta_h_n; index /= grid.theta_h_n;
+            size_t i_phi_h   = index;
+
+            /* Difference vector, rotated into the frame of the half vector */
+            float sin_theta_d = std::sin(theta_d[i_theta_d]), cos_theta_d = std::cos(theta_d[i_theta_d]),
+                  sin_phi_d   = std::sin(phi_d[i_phi_d]),     cos_phi_d   = std::cos(phi_d[i_phi_d]),
+                  sin_theta_h = std::sin(theta_h[i_theta_h]), cos_theta_h = std::cos(theta_h[i_theta_h]),
+                  sin_phi_h   = std::sin(phi_h[i_phi_h]),     cos_phi_h   = std::cos(phi_h[i_phi_h]);
+            auto to_world = [&](float x, float y, float z) {
+                float x_h = x * cos_theta_h + z * sin_theta_h,
+                      z_h = z * cos_theta_h - x * sin_theta_h;
+                return Vector3f(x_h * cos_phi_h - y * sin_phi_h,
+                                x_h * sin_phi_h + y * cos_phi_h,
+                                z_h);
+            };
+            float x_d = sin_theta_d * cos_phi_d,
+                  y_d = sin_theta_d * sin_phi_d;
+            Vector3f wi_j = to_world(x_d, y_d, cos_theta_d),
+                     wo_j = to_world(-x_d, -y_d, cos_theta_d);
+            for (size_t k = 0; k < 3; ++k) {
+                wi_data[k * block_size + j] = wi_j[k];
+                wo_data[k * block_size + j] = wo_j[k];
+            }
+        });
+
+        if (grid.rgb)
+            eval_rgb_batch(count, wi, wo, values.data(), block_size);
+        else
+            eval_batch(count, wi, wo, values.data(), block_size);
+
+        /* f_r * cos -> f_r (0 below the horizon) */
+        parallel_for(0, count, [&](size_t j) {
+            float cos_theta_o = wo.z[j],
+                  inv_cos = cos_theta_o > 0 ? 1.f / cos_theta_o : 0.f;
+            for (size_t c = 0; c < n_channels; ++c)
+                interleaved[j * n_channels + c] = values[c * block_size + j] * inv_cos;
+        });
+
+        write(interleaved.data(), count * n_channels * sizeof(float));
+    }
+}
+
+/// Splits the cells of the theta_n x phi_n grid sampled by set_state where the
+/// luminance or the color varies the most (see BRDF::Refinement). The new points
+/// are appended to 'slots' in a deterministic order and evaluated in packets with
+/// compute_states(u, v, slots_out, count). Stops between two levels once 'cancelled' is set.
+template <typename Slot, typename ComputeStates>
+static void refine_grid(const BRDF::Refinement &refinement, size_t theta_n, size_t phi_n,
+                        std::vector<Slot> &slots, const ComputeStates &compute_states,
+                        const std::atomic<bool> *cancelled) {
+    /* Points are addressed on a lattice 2^max_depth times finer than the grid,
+       whose point (theta, phi) is stored in slots[(theta - 1) * phi_n + phi] */
+    const uint64_t fine = uint64_t(1) << refinement.max_depth,
+                   theta_fine = theta_n * fine,
+                   phi_fine = phi_n * fine;
+    std::unordered_map<uint64_t, size_t> refined;
+
+    auto find_point = [&](uint64_t theta, uint64_t phi) -> size_t {
+        phi %= phi_fine;
+        if (theta % fine == 0 && phi % fine == 0)
+            return (theta / fine - 1) * phi_n + phi / fine;
+        return refined.at(theta * phi_fine + phi);
+    };
+
+    float peak = 0.f;
+    for (const Slot &slot : slots)
+        if (slot.valid)
+            peak = std::max(peak, slot.luminance);
+    if (!(peak > 0))
+        return;
+
+    /* Relative luminance range (invalid points count as black) or largest
+       color difference between the corners of a cell */
+    struct Cell { uint64_t theta, phi, size; };
+    auto cell_error = [&](const Cell &cell) {
+        const Slot *corners[4] = {
+            &slots[find_point(cell.theta, cell.phi)],
+            &slots[find_point(cell.theta, cell.phi + cell.size)],
+            &slots[find_point(cell.theta + cell.size, cell.phi)],
+            &slots[find_point(cell.theta + cell.size, cell.phi + cell.size)]
+        };
+        float min_luminance = std::numeric_limits<float>::infinity(),
+              max_luminance = 0.f,
+              color_error = 0.f;
+        for (int i = 0; i < 4; ++i) {
+            float luminance = corners[i]->valid ? corners[i]->luminance : 0.f;
+            min_luminance = std::min(min_luminance, luminance);
+            max_luminance = std::max(max_luminance, luminance);
+            for (int j = 0; j < i; ++j) {
+                if (!corners[i]->valid || !corners[j]->valid)
+                    continue;
+                for (int k = 0; k < 3; ++k)
+                    color_error = std::max(color_error, std::abs(corners[i]->color[k] - corners[j]->color[k]));
+            }
+        }
+        return std::max((max_luminance - min_luminance) / peak, color_error);
+    };
+
+    /* The cells between the pole and the first row are left as they are */
+    std::vector<Cell> cells;
+    for (size_t theta = 1; theta + 1 < theta_n; ++theta)
+        for (size_t phi = 0; phi < phi_n; ++phi)
+            cells.push_back(Cell{ theta * fine, phi * fine, fine });
+
+    /* One level at a time, so that the new points are evaluated in parallel */
+    while (!cells.empty() && slots.size() < refinement.max_points &&
+           !(cancelled && *cancelled)) {
+        std::vector<std::pair<float, size_t>> candidates;
+        for (size_t i = 0; i < cells.size(); ++i) {
+            if (cells[i].size < 2)
+                continue;
+            float error = cell_error(cells[i]);
+            if (error > refinement.tolerance)
+                candidates.emplace_back(error, i);
+        }
+
+        /* Split the most varying cells first, as long as the budget allows */
+        std::sort(candidates.begin(), candidates.end(),
+            [](const std::pair<float, size_t> &a, const std::pair<float, size_t> &b) {
+                return a.first > b.first || (a.first == b.first && a.second < b.second);
+            });
+
+        size_t n_slots = slots.size();
+        std::vector<std::pair<uint64_t, uint64_t>> points;
+        std::vector<Cell> children;
+        for (const auto &candidate : candidates) {
+            if (n_slots + points.size() + 5 > refinement.max_points)
+                break;
+            const Cell &cell = cells[candidate.second];
+            uint64_t half = cell.size / 2;
+            const uint64_t new_points[5][2] = {
+                { cell.theta + half,      cell.phi + half },
+                { cell.theta,             cell.phi + half },
+                { cell.theta + cell.size, cell.phi + half },
+                { cell.theta + half,      cell.phi },
+                { cell.theta + half,      (cell.phi + cell.size) % phi_fine }
+            };
+            for (const auto &point : new_points) {
+                /* The middle of an edge is shared with the neighboring cell */
+                if (refined.emplace(point[0] * phi_fine + point[1], n_slots + points.size()).second)
+                    points.emplace_back(point[0], point[1]);
+            }
+            for (uint64_t i = 0; i < 4; ++i)
+                children.push_back(Cell{ cell.theta + (i / 2) * half, cell.phi + (i % 2) * half, half });
+        }
+        if (points.empty())
+            break;
+
+        slots.resize(n_slots + points.size());
+        size_t n_packets = (points.size() + PacketSize - 1) / PacketSize;
+        parallel_for(0, n_packets, [&](size_t packet) {
+            size_t first = packet * PacketSize,
+                   count = std::min(PacketSize, points.size() - first);
+            FloatP u, v;
+            for (size_t l = 0; l < PacketSize; ++l) {
+                const auto &point = points[first + std::min(l, count - 1)];
+                v[l] = float(point.first) / float(theta_fine);
+                u[l] = float(point.second) / float(phi_fine);
+            }
+            compute_states(u, v, &slots[n_slots + first], count);
+        });
+
+        cells.swap(children);
+    }
+}
+
+bool BRDF::set_state(const Vector3f &wi, size_t theta_n, size_t phi_n,
+                    std::vector<float>& luminance_out, std::vector<Vector3f>& wos_out,
+                    std::vector<Vector3f>& colors_out) {
+    return set_state(wi, theta_n, phi_n, luminance_out, wos_out, colors_out, Refinement());
 }
 
 bool BRDF::set_state(const Vector3f &wi, size_t theta_n, size_t phi_n,
                     std::vector<float>& luminance_out, std::vector<Vector3f>& wos_out,
-                    std::vector<Vector3f>& colors_out)
+                    std::vector<Vector3f>& colors_out,
+                    const Refinement &refinement,
+                    const std::atomic<bool> *cancelled)
 {
     // if the state doesn't change
     if (wi[0] == m_wi[0] && wi[1] == m_wi[1] && wi[2] == m_wi[2] &&
         theta_n == m_theta_n &&
-        phi_n == m_phi_n)
+        phi_n == m_phi_n &&
+        refinement == m_refinement)
         return false;
 
     m_theta_n = theta_n;
     m_phi_n = phi_n;
+    m_refinement = refinement;
     m_wi = wi;
 
-    size_t max_points = theta_n * phi_n + phi_n;
+    size_t max_points = std::max(theta_n * phi_n + phi_n, refinement.max_points);
     m_samples.clear();
     m_scales.clear();
     wos_out.clear();
@@ -1286,77 +2741,104 @@ bool BRDF::set_state(const Vector3f &wi, size_t theta_n, size_t phi_n,
 
     m_params[0] = phi_i;
     m_params[1] = theta_i;
+    m_prepared = m_data->prepare(m_params);
     Vector2f u_wi = Vector2f(theta2u(theta_i), phi2u(phi_i));
 
-    auto compute_state = [&](float u, float v) {
-        Vector2f sample = Vector2f(v, u);
+    /* Each point of the grid (and of the boundary ring) gets its own slot, so
+       that they can be evaluated in parallel. The valid ones are compacted in
+       order afterwards, which keeps the output independent of the scheduling. */
+    struct Slot {
+        Vector2f sample;
+        Vector3f wo;
+        float scale;
+        float luminance;
+        Vector3f color;
+        bool valid;
+    };
+    size_t n_grid_points = (theta_n > 0 ? theta_n - 1 : 0) * phi_n;
+    std::vector<Slot> slots(n_grid_points + 1 + phi_n);
+
+    /* The projected area is the same for every point */
+    float sigma_scale = 4 * m_data->sigma.eval(u_wi);
+
+    /* Evaluate 'count' points (u[l], v[l]) at once, the remaining lanes are ignored */
+    auto compute_states = [&](const FloatP &u, const FloatP &v, Slot *slots_out, size_t count) {
+        Vector2fP sample = Vector2fP(v, u);
 
         #if POWITACQ_SAMPLE_LUMINANCE
+            FloatP lum_pdf;
             std::tie(sample, lum_pdf) =
-                m_data->luminance.sample(sample, m_params);
+                m_data->luminance.sample(sample, m_prepared);
         #endif
 
-        Vector2f u_wm;
-        float ndf_pdf;
+        Vector2fP u_wm;
+        FloatP ndf_pdf;
         std::tie(u_wm, ndf_pdf) =
-            m_data->vndf.sample(sample, m_params);
-
-        float phi_m   = u2phi(u_wm.y()),
-              theta_m = u2theta(u_wm.x());
-        if (m_data->isotropic)
-            phi_m += phi_i;
-
-        /* Spherical -> Cartesian coordinates */
-        float sin_phi_m = std::sin(phi_m),
-              cos_phi_m = std::cos(phi_m),
-              sin_theta_m = std::sin(theta_m),
-              cos_theta_m = std::cos(theta_m);
-
-        Vector3f wm = Vector3f(
-            cos_phi_m * sin_theta_m,
-            sin_phi_m * sin_theta_m,
-            cos_theta_m
-        );
+            m_data->vndf.sample(sample, m_prepared);
+
+        FloatP scale = m_data->ndf.eval(u_wm) / FloatP(sigma_scale),
+               luminance = m_data->luminance.eval(sample, m_prepared) * scale,
+               rgb[3] = {
+                   m_data->rgb[0].eval(sample, m_prepared),
+                   m_data->rgb[1].eval(sample, m_prepared),
+                   m_data->rgb[2].eval(sample, m_prepared)
+               };
+
+        for (size_t l = 0; l < count; ++l) {
+            Slot &slot = slots_out[l];
+            slot.valid = false;
+
+            float phi_m   = u2phi(u_wm.y()[l]),
+                  theta_m = u2theta(u_wm.x()[l]);
+            if (m_data->isotropic)
+                phi_m += phi_i;
+
+            /* Spherical -> Cartesian coordinates */
+            float sin_phi_m = std::sin(phi_m),
+                  cos_phi_m = std::cos(phi_m),
+                  sin_theta_m = std::sin(theta_m),
+                  cos_theta_m = std::cos(theta_m);
+
+            Vector3f wm = Vector3f(
+                cos_phi_m * sin_theta_m,
+                sin_phi_m * sin_theta_m,
+                cos_theta_m
+            );
 
-        Vector3f wo = wm * 2.f * dot(wm, wi) - wi;
-        if (wo.z() <= 0)
-            return;
+            Vector3f wo = wm * 2.f * dot(wm, wi) - wi;
+            if (wo.z() <= 0 || !(luminance[l] > 0))
+                continue;
 
-        float scale = m_data->ndf.eval(u_wm, m_params) /
-                            (4 * m_data->sigma.eval(u_wi, m_params));
-
-
-        float luminance = m_data->luminance.eval(sample, m_params) * scale;
-        if (luminance > 0) {
-            m_samples.push_back(sample);
-            wos_out.push_back(wo);
-            m_scales.push_back(scale);
-            Vector3f rgb_color = normalize(Vector3f(
-                m_data->rgb[0].eval(sample, m_params),
-                m_data->rgb[1].eval(sample, m_params),
-                m_data->rgb[2].eval(sample, m_params)
-            ));
-            for (int l = 0; l < 3; ++l)
-                rgb_color[l] = to_srgb(rgb_color[l]);
-            luminance_out.push_back(luminance);
-            colors_out.push_back(rgb_color);
+            Vector3f rgb_color = normalize(Vector3f(rgb[0][l], rgb[1][l], rgb[2][l]));
+            for (int k = 0; k < 3; ++k)
+                rgb_color[k] = to_srgb(rgb_color[k]);
+            slot = Slot{ Vector2f(sample.x()[l], sample.y()[l]), wo, scale[l],
+                         luminance[l], rgb_color, true };
         }
     };
 
-    for (float theta = 1; theta < theta_n; ++theta) // don't start at 0 to avoid duplicate points at (0, 0)
-    {
-        float v = float(theta) / theta_n;
-        for (float phi = 0; phi < phi_n; ++phi)
+    /* The rows left once cancelled are skipped (their slots stay invalid) */
+    auto is_cancelled = [cancelled]() { return cancelled && cancelled->load(std::memory_order_relaxed); };
+
+    // don't start at theta = 0 to avoid duplicate points at (0, 0)
+    parallel_for(1, theta_n, [&](size_t theta) {
+        if (is_cancelled())
+            return;
+        FloatP u, v = float(theta) / theta_n;
+        for (size_t phi = 0; phi < phi_n; phi += PacketSize)
         {
-            float u = float(phi) / phi_n;
-            compute_state(u, v);
+            size_t count = std::min(PacketSize, phi_n - phi);
+            for (size_t l = 0; l < PacketSize; ++l)
+                u[l] = float(phi + std::min(l, count - 1)) / phi_n;
+            compute_states(u, v, &slots[(theta - 1) * phi_n + phi], count);
         }
-    }
-    compute_state(0, 0);
+    });
+    compute_states(FloatP(0.f), FloatP(0.f), &slots[n_grid_points], 1);
 
     // add an artificial ring of points
-    for (size_t j = 0; j < phi_n; ++j)
-    {
+    parallel_for(0, phi_n, [&](size_t j) {
+        if (is_cancelled())
+            return;
         float phi_o = 2 * Pi * j / phi_n + phi_i;
         float theta_o_orig = 89.5f * Pi / 180.f,
               theta_o = theta_o_orig;
@@ -1390,12 +2872,11 @@ bool BRDF::set_state(const Vector3f &wi, size_t theta_n, size_t phi_n,
 
 
             float vndf_pdf;
-            std::tie(sample, vndf_pdf) = m_data->vndf.invert(u_wm, m_params);
+            std::tie(sample, vndf_pdf) = m_data->vndf.invert(u_wm, m_prepared);
 
-            scale = m_data->ndf.eval(u_wm, m_params) /
-                                (4 * m_data->sigma.eval(u_wi, m_params));
+            scale = m_data->ndf.eval(u_wm) / sigma_scale;
 
-            luminance = m_data->luminance.eval(sample, m_params) * scale;
+            luminance = m_data->luminance.eval(sample, m_prepared) * scale;
 
             if (luminance > 0)
                 break;
@@ -1416,48 +2897,145 @@ bool BRDF::set_state(const Vector3f &wi, size_t theta_n, size_t phi_n,
         );
 
         Vector3f rgb_color = normalize(Vector3f(
-            m_data->rgb[0].eval(sample, m_params),
-            m_data->rgb[1].eval(sample, m_params),
-            m_data->rgb[2].eval(sample, m_params)
+            m_data->rgb[0].eval(sample, m_prepared),
+            m_data->rgb[1].eval(sample, m_prepared),
+            m_data->rgb[2].eval(sample, m_prepared)
         ));
         for (int l = 0; l < 3; ++l)
             rgb_color[l] = to_srgb(rgb_color[l]);
 
-        m_samples.push_back(sample);
-        wos_out.push_back(wo);
-        m_scales.push_back(scale);
+        slots[n_grid_points + 1 + j] = Slot{ sample, wo, scale, luminance, rgb_color, true };
+    });
+
+    if (refinement.max_points > slots.size() && refinement.max_depth > 0 && theta_n > 2)
+        refine_grid(refinement, theta_n, phi_n, slots, compute_states, cancelled);
+
+    /* A partial state must not be mistaken for the requested one by the next call */
+    if (is_cancelled()) {
+        m_theta_n = m_phi_n = 0;
+        m_wi = Vector3f(0.f);
+        m_n_points = 0;
+        return false;
+    }
 
-        luminance_out.push_back(luminance);
-        colors_out.push_back(rgb_color);
+    for (const Slot &slot : slots)
+    {
+        if (!slot.valid)
+            continue;
+        m_samples.push_back(slot.sample);
+        wos_out.push_back(slot.wo);
+        m_scales.push_back(slot.scale);
+        luminance_out.push_back(slot.luminance);
+        colors_out.push_back(slot.color);
     }
 
     m_n_points = wos_out.size();
     return true;
 }
 
+void BRDF::swap_state(State &state)
+{
+    std::swap(m_theta_n, state.theta_n);
+    std::swap(m_phi_n, state.phi_n);
+    std::swap(m_refinement, state.refinement);
+    std::swap(m_n_points, state.n_points);
+    std::swap(m_wi, state.wi);
+    std::swap(m_params, state.params);
+    std::swap(m_prepared, state.prepared);
+    m_samples.swap(state.samples);
+    m_scales.swap(state.scales);
+}
+
 void BRDF::sample_state(size_t wavelength_index, float* frs_out) const
 {
-    for (size_t i = 0; i < m_samples.size(); ++i)
-    {
-        float params_fr[3] = { m_params[0], m_params[1], m_data->wavelengths[wavelength_index] };
-        frs_out[i] = m_data->spectra.eval(m_samples[i], params_fr) * m_scales[i];
-    }
+    size_t n_samples = m_samples.size();
+    PreparedParams<3> prepared = m_data->prepare_wavelength(m_prepared, wavelength_index);
+
+    // evaluate the points by packets (the last one repeats the last point to fill its lanes)
+    parallel_for(0, (n_samples + PacketSize - 1) / PacketSize, [&](size_t packet) {
+        size_t first = packet * PacketSize;
+        Vector2fP sample;
+        for (size_t l = 0; l < PacketSize; ++l)
+        {
+            const Vector2f &point = m_samples[std::min(first + l, n_samples - 1)];
+            sample.x()[l] = point.x();
+            sample.y()[l] = point.y();
+        }
+
+        FloatP frs = m_data->eval_spectra(sample, prepared);
+        for (size_t l = 0; l < PacketSize && first + l < n_samples; ++l)
+            frs_out[first + l] = frs[l] * m_scales[first + l];
+    });
 }
 
-Spectrum BRDF::sample_state(size_t point_index) const
+// number of packets of points evaluated together by sample_state_all
+static constexpr size_t STATE_BLOCK_PACKETS = 32;
+
+void BRDF::sample_state_all(float* frs_out, size_t row_stride) const
 {
-    if (point_index >= m_samples.size())
-        return zero();
+    size_t n_samples = m_samples.size(),
+           n_wavelengths = m_data->wavelengths.size();
+    if (n_samples == 0)
+        return;
+
+    // the wavelengths are tabulated: their slices of the spectra are read directly
+    std::vector<PreparedParams<3>> prepared(n_wavelengths);
+    for (size_t i = 0; i < n_wavelengths; ++i)
+        prepared[i] = m_data->prepare_wavelength(m_prepared, i);
+
+    // the points are processed by blocks, wavelength after wavelength, so that
+    // the slice being read stays in cache (the last packet repeats the last
+    // point to fill its lanes)
+    size_t n_packets = (n_samples + PacketSize - 1) / PacketSize;
+    parallel_for(0, (n_packets + STATE_BLOCK_PACKETS - 1) / STATE_BLOCK_PACKETS, [&](size_t block) {
+        size_t first_packet = block * STATE_BLOCK_PACKETS,
+               block_packets = std::min(STATE_BLOCK_PACKETS, n_packets - first_packet);
+
+        Vector2fP samples[STATE_BLOCK_PACKETS];
+        for (size_t p = 0; p < block_packets; ++p)
+        {
+            size_t first = (first_packet + p) * PacketSize;
+            for (size_t l = 0; l < PacketSize; ++l)
+            {
+                const Vector2f &point = m_samples[std::min(first + l, n_samples - 1)];
+                samples[p].x()[l] = point.x();
+                samples[p].y()[l] = point.y();
+            }
+        }
+
+        for (size_t i = 0; i < n_wavelengths; ++i)
+        {
+            float *row = frs_out + i * row_stride;
+            for (size_t p = 0; p < block_packets; ++p)
+            {
+                FloatP frs = m_data->eval_spectra(samples[p], prepared[i]);
+                size_t first = (first_packet + p) * PacketSize;
+                for (size_t l = 0; l < PacketSize && first + l < n_samples; ++l)
+                    row[first + l] = frs[l] * m_scales[first + l];
+            }
+        }
+    });
+}
 
+Spectrum BRDF::sample_state(size_t point_index) const
+{
     Spectrum s = zero();
+    sample_state_spectrum(point_index, &s[0]);
+    return s;
+}
 
-    for (size_t wavelength_index = 0; wavelength_index < s.size(); ++wavelength_index)
+void BRDF::sample_state_spectrum(size_t point_index, float *out, const WavelengthMask *mask) const
+{
+    size_t n = n_wavelengths();
+    if (point_index >= m_samples.size())
     {
-        float params_fr[3] = { m_params[0], m_params[1], m_data->wavelengths[wavelength_index] };
-        s[wavelength_index] = m_data->spectra.eval(m_samples[point_index], params_fr) * m_scales[point_index];
+        for_each_wavelength(n, mask, [&](size_t i) { out[i] = 0.f; });
+        return;
     }
 
-    return s;
+    m_data->eval_spectrum(m_samples[point_index], m_prepared, out, mask);
+    float scale = m_scales[point_index];
+    for_each_wavelength(n, mask, [&](size_t i) { out[i] *= scale; });
 }
 
 POWITACQ_NAMESPACE_END
@@ -21,6 +21,7 @@ public:
     {}
 
     inline void resize(size_t n_wavelengths, size_t n_sample_points) { m_data.resize(n_wavelengths + 3, n_sample_points); }
+    inline void conservative_resize(size_t n_wavelengths, size_t n_sample_points) { m_data.conservative_resize(n_wavelengths + 3, n_sample_points); }
     inline void assign(size_t n_wavelengths, size_t n_sample_points, float v) { m_data.assign(n_wavelengths + 3, n_sample_points, v); }
     inline void clear() { m_data.clear(); }
 
@@ -25,6 +25,11 @@ public:
     std::function<void(Vector2f)> final_callback() const { return m_final_callback; }
     void set_final_callback(const std::function<void(Vector2f)> &callback) { m_final_callback = callback; }
 
+    // colors the slider with a map of values in [0, 1] over its range: n_x by n_y cells, value[x * n_y + y]
+    void set_overlay(const vector<float>& values, size_t n_x, size_t n_y);
+    void clear_overlay() { m_overlay.clear(); }
+    bool has_overlay() const { return !m_overlay.empty(); }
+
     virtual Vector2i preferred_size(NVGcontext *ctx) const override;
     virtual bool mouse_drag_event(const Vector2i &p, const Vector2i &rel, int button, int modifiers) override;
     virtual bool mouse_button_event(const Vector2i &p, int button, bool down, int modifiers) override;
@@ -36,6 +41,9 @@ protected:
     std::function<void(Vector2f)> m_final_callback;
     std::pair<Vector2f, Vector2f> m_range;
     Color m_highlight_color;
+    vector<float> m_overlay;
+    size_t m_overlay_n_x;
+    size_t m_overlay_n_y;
 };
 
 TEKARI_NAMESPACE_END
\ No newline at end of file
@@ -2,17 +2,37 @@
 
 #include <tekari/dataset.h>
 #include <tekari/raw_data_processing.h>
+#include <tekari/dataset_cache.h>
 
 TEKARI_NAMESPACE_BEGIN
 
 class StandardDataset : public Dataset
 {
 public:
-    StandardDataset(const string &file_path)
+    StandardDataset(const string &file_path, const LoadingObserver* observer = nullptr)
     {
-        load_dataset(file_path, m_raw_measurement, m_v2d, m_wavelengths, m_metadata);
+        if (load_dataset_cache(file_path, m_raw_measurement, m_v2d, m_f, m_path_segments, m_wavelengths, m_metadata))
+        {
+            reset_buffers();
+        }
+        else
+        {
+            load_dataset(file_path, m_raw_measurement, m_v2d, m_wavelengths, m_metadata, observer);
+            recompute_data();
+            save_dataset_cache(file_path, m_raw_measurement, m_v2d, m_f, m_path_segments, m_metadata);
+        }
         compute_wavelengths_colors();
+    }
+
+    // reduced preview of a dataset still being loaded (points taken with copy_preview_points, see LoadingObserver)
+    StandardDataset(RawMeasurement&& preview, const Metadata& metadata)
+    {
+        m_raw_measurement = std::move(preview);
+        m_metadata = metadata;
+        m_metadata.init_infos(m_wavelengths);
+        finalize_preview(m_raw_measurement, m_v2d, m_metadata);
         recompute_data();
+        compute_wavelengths_colors();
     }
 
     virtual void get_selection_spectrum(vector<float> &spectrum) override
@@ -0,0 +1,233 @@
+// Throughput of the batch interface of powitacq on a synthetic tensor file
+//
+// usage: benchmark [n_directions]
+
+#define POWITACQ_IMPLEMENTATION
+#include <tekari/powitacq.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(POWITACQ_USE_TBB)
+#  include <tbb/task_arena.h>
+#endif
+
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+// shape of the synthetic tensors (an isotropic material)
+static constexpr size_t N_PHI_I = 2;
+static constexpr size_t N_THETA_I = 6;
+static constexpr size_t N_WAVELENGTHS = 64;
+static constexpr size_t RESOLUTION = 32;
+
+// Writes a tensor file with the fields read by powitacq::BRDF, filled with smooth positive values
+static void write_synthetic_tensor_file(const string& path)
+{
+    struct Field
+    {
+        string name;
+        uint8_t dtype;              // 1: uint8, 10: float32
+        vector<uint64_t> shape;
+        vector<char> data;
+    };
+
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> noise(0.9f, 1.1f);
+    auto float_field = [&](const string& name, vector<uint64_t> shape, const std::function<float(size_t)>& value) {
+        size_t size = 1;
+        for (uint64_t s : shape)
+            size *= s;
+        Field field{ name, 10, shape, vector<char>(size * sizeof(float)) };
+        for (size_t i = 0; i < size; ++i)
+        {
+            float v = value(i);
+            memcpy(field.data.data() + i * sizeof(float), &v, sizeof(float));
+        }
+        return field;
+    };
+    // a lobe around the center of each slice
+    auto lobe = [&](size_t i) {
+        float u = float(i % RESOLUTION) / (RESOLUTION - 1) - 0.5f,
+              v = float((i / RESOLUTION) % RESOLUTION) / (RESOLUTION - 1) - 0.5f;
+        return (0.1f + std::exp(-8.f * (u * u + v * v))) * noise(rng);
+    };
+
+    const char description[] = "synthetic";
+    vector<Field> fields;
+    fields.push_back(float_field("theta_i", { N_THETA_I }, [](size_t i) { return 1.5f * i / (N_THETA_I - 1); }));
+    fields.push_back(float_field("phi_i", { N_PHI_I }, [](size_t i) { return i == 0 ? -3.14159265f : 3.14159265f; }));
+    fields.push_back(float_field("wavelengths", { N_WAVELENGTHS }, [](size_t i) { return 360.f + 640.f * i / (N_WAVELENGTHS - 1); }));
+    fields.push_back(float_field("ndf", { RESOLUTION, RESOLUTION }, lobe));
+    fields.push_back(float_field("sigma", { RESOLUTION, RESOLUTION }, lobe));
+    fields.push_back(float_field("vndf", { N_PHI_I, N_THETA_I, RESOLUTION, RESOLUTION }, lobe));
+    fields.push_back(float_field("luminance", { N_PHI_I, N_THETA_I, RESOLUTION, RESOLUTION }, lobe));
+    fields.push_back(float_field("spectra", { N_PHI_I, N_THETA_I, N_WAVELENGTHS, RESOLUTION, RESOLUTION }, lobe));
+    fields.push_back(Field{ "description", 1, { sizeof(description) - 1 },
+                            vector<char>(description, description + sizeof(description) - 1) });
+    fields.push_back(Field{ "jacobian", 1, { 1 }, vector<char>(1, 1) });
+
+    // header, field descriptions, then the (aligned) field data
+    size_t offset = 12 + 2 + 4;
+    for (const Field& field : fields)
+        offset += 2 + field.name.size() + 2 + 1 + 8 + 8 * field.shape.size();
+
+    vector<uint64_t> offsets;
+    for (const Field& field : fields)
+    {
+        offset = (offset + 63) / 64 * 64;
+        offsets.push_back(offset);
+        offset += field.data.size();
+    }
+
+    std::ofstream file(path, std::ios::binary);
+    auto write = [&file](const void* data, size_t size) { file.write((const char*) data, size); };
+    const uint8_t version[2] = { 1, 0 };
+    uint32_t n_fields = (uint32_t) fields.size();
+    write("tensor_file", 12);
+    write(version, 2);
+    write(&n_fields, 4);
+    for (size_t i = 0; i < fields.size(); ++i)
+    {
+        uint16_t name_length = (uint16_t) fields[i].name.size(),
+                 n_dims = (uint16_t) fields[i].shape.size();
+        write(&name_length, 2);
+        write(fields[i].name.data(), name_length);
+        write(&n_dims, 2);
+        write(&fields[i].dtype, 1);
+        write(&offsets[i], 8);
+        write(fields[i].shape.data(), 8 * n_dims);
+    }
+    for (size_t i = 0; i < fields.size(); ++i)
+    {
+        size_t position = (size_t) file.tellp();
+        vector<char> padding(offsets[i] - position, 0);
+        write(padding.data(), padding.size());
+        write(fields[i].data.data(), fields[i].data.size());
+    }
+}
+
+// Runs f with the given number of threads and returns the number of evaluations per second
+static double throughput(size_t n_threads, size_t n, const std::function<void()>& f)
+{
+    auto run = [&]() {
+        f(); // warm up
+        auto start = std::chrono::steady_clock::now();
+        f();
+        std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+        return n / duration.count();
+    };
+#if defined(POWITACQ_USE_TBB)
+    tbb::task_arena arena((int) n_threads);
+    double result = 0.0;
+    arena.execute([&]() { result = run(); });
+    return result;
+#else
+    (void) n_threads;
+    return run();
+#endif
+}
+
+int main(int argc, char const* argv[])
+{
+    size_t n = argc > 1 ? (size_t) std::stoul(argv[1]) : 1 << 16;
+
+    string path = (std::filesystem::temp_directory_path() / "powitacq_benchmark.bsdf").string();
+    write_synthetic_tensor_file(path);
+    powitacq::BRDF brdf(path);
+    size_t n_wavelengths = brdf.n_wavelengths();
+
+    // random pairs of directions of the upper hemisphere
+    std::mt19937 rng(2);
+    std::uniform_real_distribution<float> uniform(0.f, 1.f);
+    auto direction = [&](float *out) {
+        float cos_theta = uniform(rng), phi = 2.f * 3.14159265f * uniform(rng),
+              sin_theta = std::sqrt(1.f - cos_theta * cos_theta);
+        out[0] = sin_theta * std::cos(phi);
+        out[1] = sin_theta * std::sin(phi);
+        out[2] = cos_theta;
+    };
+    vector<float> wi_data(3 * n), wo_data(3 * n), u1(n), u2(n);
+    for (size_t j = 0; j < n; ++j)
+    {
+        float v[3];
+        direction(v);
+        for (int k = 0; k < 3; ++k) wi_data[k * n + j] = v[k];
+        direction(v);
+        for (int k = 0; k < 3; ++k) wo_data[k * n + j] = v[k];
+        u1[j] = uniform(rng);
+        u2[j] = uniform(rng);
+    }
+    powitacq::Directions wi, wo;
+    wi.x = &wi_data[0]; wi.y = &wi_data[n]; wi.z = &wi_data[2 * n];
+    wo.x = &wo_data[0]; wo.y = &wo_data[n]; wo.z = &wo_data[2 * n];
+
+    vector<float> spectra(n_wavelengths * n), rgb(3 * n), pdfs(n), wos_data(3 * n);
+    powitacq::DirectionArrays<float> wos;
+    wos.x = &wos_data[0]; wos.y = &wos_data[n]; wos.z = &wos_data[2 * n];
+
+    cout << n << " directions, " << n_wavelengths << " wavelengths" << endl;
+
+    // single direction calls, as a reference
+    double scalar = throughput(1, n, [&]() {
+        for (size_t j = 0; j < n; ++j)
+        {
+            powitacq::Spectrum s = brdf.eval(wi[j], wo[j]);
+            spectra[j] = s[0];
+        }
+    });
+    cout << std::setw(32) << std::left << "eval (valarray)" << std::fixed << std::setprecision(0)
+         << scalar << " evals/s" << endl;
+
+    // thread scaling (everything runs on the calling thread without TBB)
+    vector<size_t> thread_counts;
+#if defined(POWITACQ_USE_TBB)
+    size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t n_threads = 1; n_threads < max_threads; n_threads *= 2)
+        thread_counts.push_back(n_threads);
+    thread_counts.push_back(max_threads);
+#else
+    thread_counts.push_back(1);
+#endif
+
+    struct Benchmark
+    {
+        string name;
+        std::function<void()> run;
+    };
+    vector<Benchmark> benchmarks = {
+        { "eval_batch",     [&]() { brdf.eval_batch(n, wi, wo, spectra.data(), n); } },
+        { "eval_rgb_batch", [&]() { brdf.eval_rgb_batch(n, wi, wo, rgb.data(), n); } },
+        { "sample_batch",   [&]() { brdf.sample_batch(n, u1.data(), u2.data(), wi, spectra.data(), n, &wos, pdfs.data()); } },
+        { "pdf_batch",      [&]() { brdf.pdf_batch(n, wi, wo, pdfs.data()); } },
+    };
+    for (const Benchmark& benchmark : benchmarks)
+    {
+        double single_thread = 0.0;
+        for (size_t n_threads : thread_counts)
+        {
+            double result = throughput(n_threads, n, benchmark.run);
+            if (single_thread == 0.0)
+                single_thread = result;
+            cout << std::setw(32) << std::left << benchmark.name + " (" + std::to_string(n_threads) + " threads)"
+                 << std::fixed << std::setprecision(0) << result << " evals/s"
+                 << std::setprecision(2) << "  (x" << result / single_thread << ")" << endl;
+        }
+    }
+
+    std::filesystem::remove(path);
+    return 0;
+}
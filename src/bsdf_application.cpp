@@ -29,6 +29,8 @@
 #include <tekari_resources.h>
 
 #define FOOTER_HEIGHT 25
+#define PREVIEW_MAX_POINTS 50000        // points kept in the previews of datasets being loaded
+#define PREVIEW_INTERVAL 1000           // minimum time between two previews of the same dataset (ms)
 
 using nanogui::MessageDialog;
 using nanogui::BoxLayout;
@@ -95,7 +97,7 @@ BSDFApplication::BSDFApplication(const vector<string>& dataset_paths, bool log_m
         if (!bsdf_dataset)
             return;
         
-        bsdf_dataset->set_incident_angle(incident_angle);
+        bsdf_dataset->set_incident_angle_interactive(incident_angle, [this]() { redraw(); });
         if (m_selection_info_window) toggle_selection_info_window();
         reprint_footer();
 
@@ -320,6 +322,13 @@ BSDFApplication::BSDFApplication(const vector<string>& dataset_paths, bool log_m
         (void)show_infos_button;
     }
 
+    // Loading progress (only visible while datasets are being loaded)
+    {
+        m_loading_progress_bar = new ProgressBar{ m_tool_window };
+        m_loading_progress_bar->set_tooltip("Loading datasets");
+        m_loading_progress_bar->set_visible(false);
+    }
+
     // Dataset selection
     {
         m_datasets_scroll_panel = new VScrollPanel{ m_tool_window };
@@ -644,32 +653,97 @@ void BSDFApplication::draw_contents() {
             auto new_dataset = m_datasets_to_add.try_pop();
             if (!new_dataset->dataset)
             {
+               if (new_dataset->loading && new_dataset->loading->displayed_preview)
+                   delete_dataset(new_dataset->loading->displayed_preview);
                open_error_window(new_dataset->error_msg);
             }
-            else
+            else if (!add_loaded_dataset(new_dataset))
             {
-                bool init_completed = false;
-                try {
-                    init_completed = new_dataset->dataset->init();
-                } catch (std::runtime_error) {
-                    init_completed = false;
-                }
-                if (!init_completed)
-                    open_error_window("Error while initializing the dataset");
-                else {
-                    add_dataset(new_dataset->dataset);
-                    if (m_log_mode) {
-                        new_dataset->dataset->toggle_log_view();
-                        if (m_brdf_options_window)
-                            m_display_as_log->set_pushed(m_selected_ds->display_as_log());
-                    }
-                }
+                open_error_window("Error while initializing the dataset");
             }
+            if (new_dataset->loading && !new_dataset->is_preview)
+                m_loadings.erase(find(m_loadings.begin(), m_loadings.end(), new_dataset->loading));
             redraw();
         }
     }
     catch (std::runtime_error) {
     }
+
+    // swap in the incident angle states refined and the albedo maps computed in the background
+    for (auto& dataset : m_datasets)
+    {
+        BSDFDataset* bsdf_dataset = dynamic_cast<BSDFDataset*>(dataset.get());
+        if (bsdf_dataset && bsdf_dataset->update_refinement() && dataset == m_selected_ds)
+        {
+            if (m_selection_info_window) toggle_selection_info_window();
+            reprint_footer();
+        }
+        if (bsdf_dataset && bsdf_dataset->update_albedo_map() && dataset == m_selected_ds)
+            update_albedo_overlay();
+    }
+
+    update_loading_progress();
+}
+
+// returns false if the dataset could not be initialized
+bool BSDFApplication::add_loaded_dataset(shared_ptr<Dataset_to_add> new_dataset)
+{
+    shared_ptr<DatasetLoading> loading = new_dataset->loading;
+    if (loading)
+    {
+        // the user already deleted a preview of this dataset
+        if (loading->discarded)
+            return true;
+        if (loading->displayed_preview)
+        {
+            if (dataset_index(loading->displayed_preview) == -1)
+            {
+                loading->discarded = true;
+                loading->displayed_preview = nullptr;
+                return true;
+            }
+            delete_dataset(loading->displayed_preview);
+            loading->displayed_preview = nullptr;
+        }
+    }
+
+    bool init_completed = false;
+    try {
+        init_completed = new_dataset->dataset->init();
+    } catch (std::runtime_error) {
+        init_completed = false;
+    }
+    // a preview failing is not worth reporting, the final dataset will be
+    if (!init_completed)
+        return new_dataset->is_preview;
+
+    add_dataset(new_dataset->dataset);
+    if (new_dataset->is_preview)
+        loading->displayed_preview = new_dataset->dataset;
+    if (m_log_mode) {
+        new_dataset->dataset->toggle_log_view();
+        if (m_brdf_options_window)
+            m_display_as_log->set_pushed(m_selected_ds->display_as_log());
+    }
+    return true;
+}
+
+void BSDFApplication::update_loading_progress()
+{
+    bool loading = !m_loadings.empty();
+    if (loading)
+    {
+        float progress = 0.0f;
+        for (const auto& l : m_loadings)
+            progress += l->progress;
+        m_loading_progress_bar->set_value(progress / m_loadings.size());
+    }
+    if (loading != m_loading_progress_bar->visible())
+    {
+        m_loading_progress_bar->set_visible(loading);
+        request_layout_update();
+        redraw();
+    }
 }
 
 void BSDFApplication::update_layout()
@@ -705,7 +779,14 @@ void BSDFApplication::open_dataset_dialog()
     vector<string> dataset_paths = nanogui::file_dialog(
         {
             { "txt",  "Datasets" },
-            { "bsdf",  "Datasets" }
+            { "bsdf",  "Datasets" },
+            { "tkb",  "Binary datasets" },
+#if defined(TEKARI_HAS_ZLIB)
+            { "gz",  "Compressed datasets" },
+#endif
+#if defined(TEKARI_HAS_ZSTD)
+            { "zst",  "Compressed datasets" },
+#endif
         }, false, true);
     open_files(dataset_paths);
     // Make sure we gain focus after seleting a file to be loaded.
@@ -716,8 +797,11 @@ void BSDFApplication::open_files(const vector<string>& dataset_paths)
 {
     for (const auto& dataset_path : dataset_paths)
     {
-        m_thread_pool.add_task([this, dataset_path]() {
+        auto loading = make_shared<DatasetLoading>();
+        m_loadings.push_back(loading);
+        m_thread_pool.add_task([this, dataset_path, loading]() {
             auto new_dataset = make_shared<Dataset_to_add>();
+            new_dataset->loading = loading;
             try_load_dataset(dataset_path, new_dataset);
             m_datasets_to_add.push(new_dataset);
             redraw();
@@ -725,15 +809,33 @@ void BSDFApplication::open_files(const vector<string>& dataset_paths)
     }
 }
 
+void BSDFApplication::open_files(const Catalog& catalog, const CatalogQuery& query)
+{
+    vector<string> dataset_paths;
+    for (const CatalogEntry* entry : catalog.query(query))
+        dataset_paths.push_back(entry->path);
+    if (dataset_paths.empty())
+        Log(Warning, "%s", "No indexed measurement matches the query\n");
+    open_files(dataset_paths);
+}
+
 void BSDFApplication::save_selected_dataset()
 {
     if (!m_selected_ds)
         return;
     
-    string path = nanogui::file_dialog(
-    {
-        { "txt",  "Datasets" },
-    }, true);
+    // bsdf datasets are exported as dense tables (see BSDFDataset::export_table)
+    bool is_bsdf = dynamic_cast<BSDFDataset*>(m_selected_ds.get()) != nullptr;
+    string path = is_bsdf ?
+        nanogui::file_dialog(
+        {
+            { "tensor", "Dense RGB tables (90x90x180 half/difference angles)" },
+        }, true) :
+        nanogui::file_dialog(
+        {
+            { "txt",  "Datasets" },
+            { "tkb",  "Binary datasets" },
+        }, true);
 
     if (path.empty())
         return;
@@ -878,7 +980,8 @@ void BSDFApplication::toggle_brdf_options_window()
                 m_theta_float_box->set_value(value[0]);
                 m_phi_float_box->set_value(value[1]);
 
-                bsdf_dataset->set_incident_angle(value);
+                // stays responsive while dragging, the full resolution state is swapped in once refined
+                bsdf_dataset->set_incident_angle_interactive(value, [this]() { redraw(); });
                 if (m_selection_info_window) toggle_selection_info_window();
                 reprint_footer();
             });
@@ -917,6 +1020,15 @@ void BSDFApplication::toggle_brdf_options_window()
 
             m_theta_float_box = add_float_box("Elevation:", curr_i_angle.x(), angle_slider_callback);
             m_phi_float_box = add_float_box("Azimuth:", curr_i_angle.y(), angle_slider_callback);
+
+            m_albedo_button = new Button{ window, "Compute albedo map" };
+            m_albedo_button->set_enabled(bsdf_dataset != nullptr);
+            m_albedo_button->set_callback([this, bsdf_dataset]() {
+                bsdf_dataset->start_computing_albedo_map([this]() { redraw(); });
+                update_albedo_overlay();
+            });
+            m_albedo_button->set_tooltip("Integrate the directional albedo of the BRDF over the incident angles "
+                                         "(cached on disk) and show it over the incident angle slider");
         }
 
         // wavelength slider
@@ -941,6 +1053,7 @@ void BSDFApplication::toggle_brdf_options_window()
                     m_selected_ds->set_intensity_index(wavelength_index);
                     wavelength_label->set_caption(m_selected_ds->wavelength_str());
                     reprint_footer();
+                    update_albedo_overlay();
                 });
                 wavelength_slider->set_enabled(m_selected_ds != nullptr);
                 wavelength_slider->set_value(slider_value);
@@ -950,6 +1063,38 @@ void BSDFApplication::toggle_brdf_options_window()
 
         return window;
     });
+    update_albedo_overlay();
+}
+
+void BSDFApplication::update_albedo_overlay()
+{
+    if (!m_brdf_options_window)
+        return;
+
+    BSDFDataset* bsdf_dataset = dynamic_cast<BSDFDataset*>(m_selected_ds.get());
+    if (!bsdf_dataset || !bsdf_dataset->has_albedo_map())
+    {
+        m_incident_angle_slider->clear_overlay();
+        m_albedo_button->set_caption(bsdf_dataset && bsdf_dataset->computing_albedo_map() ?
+                                     "Computing albedo map .." : "Compute albedo map");
+        return;
+    }
+
+    // luminance, or the displayed wavelength, normalized by its maximum
+    const AlbedoMap& map = bsdf_dataset->albedo_map();
+    size_t size = map.n_theta * map.n_phi;
+    size_t intensity_index = bsdf_dataset->intensity_index();
+    const float* albedo = intensity_index == 0 ? map.luminance.data() : map.spectra.data() + (intensity_index - 1) * size;
+
+    vector<float> overlay(albedo, albedo + size);
+    float max = *std::max_element(overlay.begin(), overlay.end());
+    for (float& value : overlay)
+        value = max > 0.0f ? value / max : 0.0f;
+    m_incident_angle_slider->set_overlay(overlay, map.n_theta, map.n_phi);
+
+    std::ostringstream caption;
+    caption << "Albedo map (max " << std::setprecision(3) << max << ")";
+    m_albedo_button->set_caption(caption.str());
 }
 
 void BSDFApplication::update_selection_info_window()
@@ -1272,7 +1417,51 @@ void BSDFApplication::try_load_dataset(const string& file_path, shared_ptr<Datas
         }
         else
         {
-            ds = make_shared<StandardDataset>(file_path);
+            // publish progress and reduced previews while the file is being parsed
+            shared_ptr<DatasetLoading> loading = dataset_to_add->loading;
+            Timer<std::chrono::milliseconds> preview_timer;
+            LoadingObserver observer;
+            observer.progress = [this, loading](float progress) {
+                if (!loading)
+                    return;
+                float previous_progress = loading->progress.exchange(progress);
+                if (int(progress * 100) != int(previous_progress * 100))
+                    redraw();
+            };
+            // previews are built (triangulated) by their own task so that parsing goes on meanwhile,
+            // the loading waits for the last one (when leaving this scope) before publishing the dataset
+            std::future<void> preview_building;
+            observer.snapshot = [this, loading, &preview_timer, &preview_building, file_path](
+                const RawMeasurement& raw_measurement, size_t n_points, const Metadata& metadata) {
+                if (!loading || preview_timer.value() < PREVIEW_INTERVAL)
+                    return;
+                if (preview_building.valid() &&
+                    preview_building.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+                    return;     // still building the previous one
+
+                // the parsed points keep being written to, only copy the few the preview needs
+                auto points = make_shared<RawMeasurement>();
+                copy_preview_points(raw_measurement, n_points, PREVIEW_MAX_POINTS, *points);
+                auto build_preview = [this, loading, points, metadata, file_path]() {
+                    try {
+                        auto preview = make_shared<Dataset_to_add>();
+                        preview->is_preview = true;
+                        preview->loading = loading;
+                        preview->dataset = make_shared<StandardDataset>(std::move(*points), metadata);
+                        m_datasets_to_add.push(preview);
+                        redraw();
+                    } catch (const std::exception& e) {
+                        cerr << "Unable to build a preview of \"" << file_path << "\" : " << e.what() << endl;
+                    }
+                };
+#if defined(EMSCRIPTEN)
+                build_preview();
+#else
+                preview_building = std::async(std::launch::async, build_preview);
+#endif
+                preview_timer.reset();
+            };
+            ds = make_shared<StandardDataset>(file_path, &observer);
         }
         dataset_to_add->dataset = ds;
     }
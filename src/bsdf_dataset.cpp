@@ -1,4 +1,5 @@
 #define POWITACQ_IMPLEMENTATION
+#define POWITACQ_USE_TBB
 #include <tekari/bsdf_dataset.h>
 #include <tekari/raw_data_processing.h>
 
@@ -7,15 +8,53 @@ TEKARI_NAMESPACE_BEGIN
 inline powitacq::Vector3f enoki_to_powitacq_vec3(const Vector3f& v) { return powitacq::Vector3f(v[0], v[1], v[2]); }
 inline Vector3f powitacq_to_enoki_vec3(const powitacq::Vector3f& v) { return Vector3f(v[0], v[1], v[2]); }
 
+static bool s_half_precision = false;
+
+void set_bsdf_half_precision(bool half_precision) { s_half_precision = half_precision; }
+bool bsdf_half_precision() { return s_half_precision; }
+
+static bool s_background_spectra = false;
+
+// memory budget of the states kept by each bsdf dataset
+static constexpr size_t STATE_CACHE_MEMORY = 256 << 20;
+// sampling resolution displayed while the incident angle is dragged around
+static constexpr size_t INTERACTIVE_RESOLUTION = 16;
+// grid of incident angles of the albedo maps, and samples integrating each of them
+static constexpr size_t ALBEDO_N_THETA = 18;
+static constexpr size_t ALBEDO_N_PHI = 36;
+static constexpr size_t ALBEDO_N_SAMPLES = 4096;
+
+void set_bsdf_background_spectra(bool background_spectra) { s_background_spectra = background_spectra; }
+bool bsdf_background_spectra() { return s_background_spectra; }
+
+static bool s_adaptive_sampling = false;
+
+void set_bsdf_adaptive_sampling(bool adaptive_sampling) { s_adaptive_sampling = adaptive_sampling; }
+bool bsdf_adaptive_sampling() { return s_adaptive_sampling; }
+
 BSDFDataset::BSDFDataset(const string& file_path)
-: m_brdf(file_path)
+: m_brdf(file_path, s_half_precision)
 , m_n_theta(32)
 , m_n_phi(32)
+, m_spectra_sampled(false)
+, m_work_brdf(m_brdf)
+, m_refinement_generation(0)
+, m_file_path(file_path)
 {
+    // report how long each stage of reading the file took (nothing to report if its data was shared)
+    for (const auto& stage : m_brdf.load_timings())
+        cout << std::setw(50) << std::left << stage.first + " .. "
+             << "done. (took " << time_string(stage.second) << ")" << endl;
+
     // copy the wavelengths
     m_wavelengths.resize(m_brdf.wavelengths().size());
     std::copy(begin(m_brdf.wavelengths()), end(m_brdf.wavelengths()), begin(m_wavelengths));
 
+    // wavelengths displayed by the selection spectrum
+    m_visible_wavelengths.resize(m_wavelengths.size());
+    for (size_t i = 0; i < m_wavelengths.size(); ++i)
+        m_visible_wavelengths[i] = m_wavelengths[i] > 360.0f && m_wavelengths[i] < 1000.0f;
+
     compute_wavelengths_colors();
 
     // artificially assign metadata members
@@ -23,6 +62,25 @@ BSDFDataset::BSDFDataset(const string& file_path)
     m_metadata.set_sample_name(file_path.substr(file_path.find_last_of("/") + 1, file_path.find_last_of(".")));
 }
 
+BSDFDataset::StateKey BSDFDataset::state_key(const Vector2f& incident_angle, size_t n_theta, size_t n_phi)
+{
+    StateKey key;
+    key.theta = (int) std::lround(incident_angle.x() * 100.0f);
+    key.phi = (int) std::lround(incident_angle.y() * 100.0f);
+    key.n_theta = n_theta;
+    key.n_phi = n_phi;
+    return key;
+}
+
+BSDFDataset::~BSDFDataset()
+{
+    cancel_refinement();
+    for (auto& refinement : m_cancelled_refinements)
+        refinement.wait();
+    if (m_albedo_computation.valid())
+        m_albedo_computation.wait();
+}
+
 bool BSDFDataset::init()
 {
     if (!Dataset::init())
@@ -38,7 +96,9 @@ void BSDFDataset::set_intensity_index(size_t intensity_index)
     {
         m_cache_mask[m_intensity_index] = true;
 
-        m_brdf.sample_state(m_intensity_index-1, m_raw_measurement[m_intensity_index+2].data());
+        wait_for_spectra();
+        if (!m_spectra_sampled)
+            m_brdf.sample_state(m_intensity_index-1, m_raw_measurement[m_intensity_index+2].data());
         compute_min_max_intensities(m_points_stats, m_raw_measurement, m_intensity_index);
         compute_normalized_heights(m_raw_measurement, m_points_stats, m_h, m_intensity_index);
 
@@ -50,92 +110,401 @@ void BSDFDataset::set_intensity_index(size_t intensity_index)
     update_shaders_data();
 }
 
-void BSDFDataset::set_incident_angle(const Vector2f& incident_angle_)
+void BSDFDataset::set_incident_angle(const Vector2f& incident_angle_, size_t n_theta, size_t n_phi)
 {
+    // a refinement in progress is for another incident angle or resolution
+    cancel_refinement();
 
     Vector2f incident_angle(incident_angle_);
     incident_angle.x() = std::max(incident_angle.x(), 1e-6f);
     cout << std::setw(50) << std::left << "Setting incident angle ..";
     Timer<> timer;
 
-    vector<float> luminance;
-    vector<powitacq::Vector3f> wos;
-    vector<powitacq::Vector3f> colors;
-    if (!m_brdf.set_state(enoki_to_powitacq_vec3(hemisphere_to_vec3<Vector3f>(incident_angle)), m_n_theta, m_n_phi, luminance, wos, colors))
+    StateKey key = state_key(incident_angle, n_theta, n_phi);
+    if (key == m_state_key)
     {
         cout << "done. (took " <<  time_string(timer.value()) << ")" << endl;
         return;
     }
+
+    // revisiting a cached state only needs to swap it back in
+    auto cached = std::find_if(m_state_cache.begin(), m_state_cache.end(),
+                               [&key](const CachedState& state) { return state.key == key; });
+    if (cached != m_state_cache.end())
+    {
+        CachedState state = std::move(*cached);
+        m_state_cache.erase(cached);
+        cout << "done. (took " <<  time_string(timer.value()) << ", cached)" << endl;
+        display_state(std::move(state), incident_angle);
+        return;
+    }
+
+    CachedState state;
+    std::atomic<bool> cancelled(false);
+    bool computed = compute_state(m_work_brdf, incident_angle, n_theta, n_phi, state, cancelled);
     cout << "done. (took " <<  time_string(timer.value()) << ")" << endl;
+    if (computed)
+        display_state(std::move(state), incident_angle);
+}
+
+void BSDFDataset::set_incident_angle_interactive(const Vector2f& incident_angle_, function<void()> on_refined)
+{
+    Vector2f incident_angle(incident_angle_);
+    incident_angle.x() = std::max(incident_angle.x(), 1e-6f);
+
+    StateKey key = state_key(incident_angle, m_n_theta, m_n_phi);
+    if (m_refinement && key == state_key(m_refinement->incident_angle, m_n_theta, m_n_phi))
+        return;     // already being refined
+
+    // nothing to refine if the state is cheap enough or cached, or if there is no thread to refine it
+    size_t n_theta = std::min(m_n_theta, INTERACTIVE_RESOLUTION);
+    size_t n_phi = std::min(m_n_phi, INTERACTIVE_RESOLUTION);
+#if defined(EMSCRIPTEN)
+    bool refine = false;
+#else
+    bool refine = (n_theta != m_n_theta || n_phi != m_n_phi) && !(key == m_state_key) &&
+                  std::none_of(m_state_cache.begin(), m_state_cache.end(),
+                               [&key](const CachedState& state) { return state.key == key; });
+#endif
+    if (!refine)
+    {
+        set_incident_angle(incident_angle);
+        return;
+    }
 
-    size_t n_intensities = m_brdf.wavelengths().size() + 1;     // account for luminance
+    set_incident_angle(incident_angle, n_theta, n_phi);
+
+    // the task only touches its own refinement, with a copy of the (stateless) work brdf
+    m_refinement = std::make_shared<Refinement>(++m_refinement_generation, incident_angle, m_work_brdf);
+    n_theta = m_n_theta;
+    n_phi = m_n_phi;
+    m_refinement_task = std::async(std::launch::async, [refinement = m_refinement, n_theta, n_phi, on_refined]() {
+        Timer<> timer;
+        if (!compute_state(refinement->brdf, refinement->incident_angle, n_theta, n_phi,
+                           refinement->state, refinement->cancelled))
+            return false;
+        refinement->time = timer.value();
+        if (on_refined)
+            on_refined();
+        return true;
+    });
+}
+
+bool BSDFDataset::update_refinement()
+{
+    if (!m_refinement_task.valid() ||
+        m_refinement_task.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        return false;
+
+    std::shared_ptr<Refinement> refinement = std::move(m_refinement);
+    // drop the result if another refinement was started since
+    if (!m_refinement_task.get() || refinement->generation != m_refinement_generation)
+        return false;
+
+    cout << std::setw(50) << std::left << "Refining incident angle .."
+         << "done. (took " << time_string(refinement->time) << ")" << endl;
+    display_state(std::move(refinement->state), refinement->incident_angle);
+    return true;
+}
+
+void BSDFDataset::cancel_refinement()
+{
+    ++m_refinement_generation;
+
+    // forget the cancelled refinements that are over
+    m_cancelled_refinements.remove_if([](const std::future<bool>& refinement) {
+        return refinement.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    });
+
+    if (!m_refinement_task.valid())
+        return;
+
+    // the task stops at its next check, it is kept aside rather than waited for
+    m_refinement->cancelled = true;
+    m_cancelled_refinements.push_back(std::move(m_refinement_task));
+    m_refinement.reset();
+}
+
+bool BSDFDataset::compute_state(powitacq::BRDF& brdf, const Vector2f& incident_angle, size_t n_theta, size_t n_phi,
+                                CachedState& state, const std::atomic<bool>& cancelled)
+{
+    vector<float> luminance;
+    vector<powitacq::Vector3f> wos;
+    vector<powitacq::Vector3f> colors;
+    // adaptively: a grid of a quarter of the resolution, refined back to it where the measurement varies the most
+    powitacq::BRDF::Refinement refinement;
+    size_t grid_theta = n_theta, grid_phi = n_phi;
+    if (s_adaptive_sampling && n_theta >= 64 && n_phi >= 64)
+    {
+        grid_theta = n_theta / 4;
+        grid_phi = n_phi / 4;
+        refinement.max_depth = 2;
+        refinement.max_points = n_theta * n_phi / 2;
+    }
+    bool valid = brdf.set_state(enoki_to_powitacq_vec3(hemisphere_to_vec3<Vector3f>(incident_angle)), grid_theta, grid_phi,
+                                luminance, wos, colors, refinement, &cancelled);
+
+    // hand the brdf state over, leaving the brdf without one so that its next set_state always computes
+    state.brdf_state = powitacq::BRDF::State();
+    brdf.swap_state(state.brdf_state);
+    if (!valid || cancelled)
+        return false;
+
+    state.key = state_key(incident_angle, n_theta, n_phi);
+
+    size_t n_intensities = brdf.wavelengths().size() + 1;     // account for luminance
     size_t n_sample_points = wos.size();
 
-    m_raw_measurement.resize(n_intensities, n_sample_points);
-    m_v2d.resize(n_sample_points);
-    m_colors.resize(n_sample_points, 3);
+    state.raw_measurement.resize(n_intensities, n_sample_points);
+    state.v2d.resize(n_sample_points);
+    state.colors.resize(n_sample_points, 3);
 
-    m_h[0].resize (n_intensities, n_sample_points);
-    m_h[1].resize(n_intensities, n_sample_points);
-    m_n[0].resize (n_intensities, n_sample_points);
-    m_n[1].resize(n_intensities, n_sample_points);
-    m_cache_mask.resize(n_intensities);
-    m_points_stats.reset(n_intensities);
-    m_selection_stats.reset(n_intensities);
+    state.h[0].resize(n_intensities, n_sample_points);
+    state.h[1].resize(n_intensities, n_sample_points);
+    state.n[0].resize(n_intensities, n_sample_points);
+    state.n[1].resize(n_intensities, n_sample_points);
+    state.points_stats.reset(n_intensities);
 
     // clear mask
-    m_cache_mask.assign(n_intensities, false);
-    m_cache_mask[0] = true;                     // luminance is always computed
-
-    // artificially assign metadata members
-    m_metadata.set_incident_angle(incident_angle);
-    m_metadata.set_points_in_file(m_raw_measurement.n_sample_points());
-    m_selected_points.assign(m_raw_measurement.n_sample_points(), NOT_SELECTED_FLAG);
+    state.cache_mask.assign(n_intensities, false);
+    state.cache_mask[0] = true;                 // luminance is always computed
+    state.spectra_sampled = false;
 
     for (size_t i = 0; i < wos.size(); ++i)
     {
         Vector2f outgoing_angle = vec3_to_hemisphere<Vector2f>(wos[i]);
-        m_raw_measurement.set_theta(i, outgoing_angle.x());
-        m_raw_measurement.set_phi(i, outgoing_angle.y());
-        m_raw_measurement.set_luminance(i, luminance[i]);
-        m_v2d[i] = vec3_to_disk<Vector2f>(wos[i]);
-
-        m_colors[i][0] = colors[i][0];
-        m_colors[i][1] = colors[i][1];
-        m_colors[i][2] = colors[i][2];
+        state.raw_measurement.set_theta(i, outgoing_angle.x());
+        state.raw_measurement.set_phi(i, outgoing_angle.y());
+        state.raw_measurement.set_luminance(i, luminance[i]);
+        state.v2d[i] = vec3_to_disk<Vector2f>(wos[i]);
+
+        state.colors[i][0] = colors[i][0];
+        state.colors[i][1] = colors[i][1];
+        state.colors[i][2] = colors[i][2];
     }
 
-    triangulate_data(m_f, m_v2d);
-    compute_path_segments(m_path_segments, m_v2d);
+    triangulate_data(state.f, state.v2d);
+    if (cancelled)
+        return false;
+    compute_path_segments(state.path_segments, state.v2d);
 
     // compute data for luminance
-    compute_min_max_intensities(m_points_stats, m_raw_measurement, 0);
-    compute_normalized_heights(m_raw_measurement, m_points_stats, m_h, 0);
-    update_points_stats(m_points_stats, m_raw_measurement, m_v2d, m_h, 0);
+    compute_min_max_intensities(state.points_stats, state.raw_measurement, 0);
+    compute_normalized_heights(state.raw_measurement, state.points_stats, state.h, 0);
+    update_points_stats(state.points_stats, state.raw_measurement, state.v2d, state.h, 0);
+    compute_normals(state.f, state.v2d, state.h, state.n, 0);
+    return !cancelled;
+}
+
+void BSDFDataset::display_state(CachedState&& state, const Vector2f& incident_angle)
+{
+    // the sampling of the previous incident angle still reads the state and fills the measurement
+    wait_for_spectra();
+
+    swap_state(state);
+    cache_state(std::move(state));
+
+    // artificially assign metadata members
+    size_t n_intensities = m_raw_measurement.n_wavelengths() + 1;
+    m_metadata.set_incident_angle(incident_angle);
+    m_metadata.set_points_in_file(m_raw_measurement.n_sample_points());
+    m_selected_points.assign(m_raw_measurement.n_sample_points(), NOT_SELECTED_FLAG);
+    m_selection_stats.reset(n_intensities);
     update_selection_stats(m_selection_stats, m_selected_points, m_raw_measurement, m_v2d, m_h, 0);
-    compute_normals(m_f, m_v2d, m_h, m_n, 0);
+
+    if (s_background_spectra && !m_spectra_sampled)
+        start_sampling_spectra();
 
     link_data_to_shaders();
     set_intensity_index(m_intensity_index);
 }
 
+size_t BSDFDataset::CachedState::memory_size() const
+{
+    return raw_measurement.size() * sizeof(float) +
+           v2d.size() * sizeof(Vector2f) +
+           f.size() * sizeof(int) +
+           path_segments.size() * sizeof(uint32_t) +
+           colors.size() * sizeof(float) +
+           (h[0].size() + h[1].size()) * sizeof(float) +
+           (n[0].size() + n[1].size()) * sizeof(Vector4f) +
+           brdf_state.samples.size() * sizeof(powitacq::Vector2f) +
+           brdf_state.scales.size() * sizeof(float);
+}
+
+void BSDFDataset::swap_state(CachedState& state)
+{
+    std::swap(m_state_key, state.key);
+    m_brdf.swap_state(state.brdf_state);
+    std::swap(m_raw_measurement, state.raw_measurement);
+    std::swap(m_v2d, state.v2d);
+    std::swap(m_f, state.f);
+    std::swap(m_path_segments, state.path_segments);
+    std::swap(m_colors, state.colors);
+    for (int i = 0; i < 2; ++i)
+    {
+        std::swap(m_h[i], state.h[i]);
+        std::swap(m_n[i], state.n[i]);
+    }
+    std::swap(m_cache_mask, state.cache_mask);
+    std::swap(m_points_stats, state.points_stats);
+    std::swap(m_spectra_sampled, state.spectra_sampled);
+}
+
+void BSDFDataset::cache_state(CachedState&& state)
+{
+    if (state.key.n_theta == 0)
+        return;
+    m_state_cache.push_front(std::move(state));
+
+    size_t memory = 0;
+    auto it = m_state_cache.begin();
+    for (; it != m_state_cache.end(); ++it)
+    {
+        memory += it->memory_size();
+        if (memory > STATE_CACHE_MEMORY)
+            break;
+    }
+    m_state_cache.erase(it, m_state_cache.end());
+}
+
+void BSDFDataset::sample_spectra()
+{
+    // the intensity rows are contiguous, the first one starting right after the luminance
+    m_brdf.sample_state_all(m_raw_measurement.intensity(0).data(), m_raw_measurement.n_sample_points());
+}
+
+void BSDFDataset::start_sampling_spectra()
+{
+    // sample all the wavelengths in one pass while the luminance is displayed,
+    // so that browsing them afterwards doesn't need to sample anything
+    // (displaying a wavelength first waits for the pass to complete)
+    m_spectra_sampled = true;
+#if defined(EMSCRIPTEN)
+    sample_spectra();
+#else
+    m_spectra_sampling = std::async(std::launch::async, [this]() { sample_spectra(); });
+#endif
+}
+
+void BSDFDataset::wait_for_spectra()
+{
+    if (m_spectra_sampling.valid())
+        m_spectra_sampling.get();
+}
+
+void BSDFDataset::export_table(const string& path, const powitacq::BRDF::TableGrid& grid) const
+{
+    cout << std::setw(50) << std::left << "Exporting dense table .. ";
+    Timer<> timer;
+    m_brdf.export_table(path, grid);
+    cout << "done. (took " << time_string(timer.value()) << ")" << endl;
+}
+
+void BSDFDataset::start_computing_albedo_map(function<void()> on_computed)
+{
+    if (has_albedo_map() || computing_albedo_map())
+        return;
+
+    AlbedoMap map;
+    map.n_theta = ALBEDO_N_THETA;
+    map.n_phi = ALBEDO_N_PHI;
+    map.n_samples = ALBEDO_N_SAMPLES;
+    if (load_albedo_map_cache(m_file_path, map))
+    {
+        m_albedo_map = std::move(map);
+        if (on_computed)
+            on_computed();
+        return;
+    }
+
+    auto compute = [this, map, on_computed]() mutable {
+        Timer<> timer;
+
+        // incident directions at the centers of the cells of the incident angle slider
+        // (a single azimuth is enough for isotropic brdfs)
+        size_t n_phi = m_brdf.isotropic() ? 1 : map.n_phi;
+        size_t n = map.n_theta * n_phi;
+        vector<float> wi_data(3 * n);
+        for (size_t i = 0; i < map.n_theta; ++i)
+        {
+            for (size_t j = 0; j < n_phi; ++j)
+            {
+                Vector2f angle((i + 0.5f) * 85.0f / map.n_theta, (j + 0.5f) * 360.0f / map.n_phi - 180.0f);
+                Vector3f wi = hemisphere_to_vec3<Vector3f>(angle);
+                for (size_t k = 0; k < 3; ++k)
+                    wi_data[k * n + i * n_phi + j] = wi[k];
+            }
+        }
+        powitacq::Directions wi;
+        wi.x = &wi_data[0];
+        wi.y = &wi_data[n];
+        wi.z = &wi_data[2 * n];
+
+        // integration only reads the tables of the brdf, not its state
+        size_t n_wavelengths = m_brdf.n_wavelengths();
+        vector<float> luminance(n), spectra(n_wavelengths * n);
+        m_brdf.albedo_batch(n, wi, map.n_samples, spectra.data(), n, luminance.data());
+
+        // spread the values over all the azimuths
+        size_t size = map.n_theta * map.n_phi;
+        map.luminance.resize(size);
+        map.spectra.resize(n_wavelengths * size);
+        for (size_t i = 0; i < map.n_theta; ++i)
+        {
+            for (size_t j = 0; j < map.n_phi; ++j)
+            {
+                size_t index = i * n_phi + j % n_phi;
+                map.luminance[i * map.n_phi + j] = luminance[index];
+                for (size_t w = 0; w < n_wavelengths; ++w)
+                    map.spectra[w * size + i * map.n_phi + j] = spectra[w * n + index];
+            }
+        }
+
+        cout << std::setw(50) << std::left << "Computing albedo map .. "
+             << "done. (took " << time_string(timer.value()) << ")" << endl;
+        save_albedo_map_cache(m_file_path, map);
+        if (on_computed)
+            on_computed();
+        return map;
+    };
+#if defined(EMSCRIPTEN)
+    m_albedo_map = compute();
+#else
+    m_albedo_computation = std::async(std::launch::async, compute);
+#endif
+}
+
+bool BSDFDataset::update_albedo_map()
+{
+    if (!m_albedo_computation.valid() ||
+        m_albedo_computation.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        return false;
+
+    m_albedo_map = m_albedo_computation.get();
+    return true;
+}
+
 void BSDFDataset::get_selection_spectrum(vector<float> &spectrum)
 {
     size_t point_index = m_selection_stats[m_intensity_index].highest_point_index;
-    powitacq::Spectrum s = m_brdf.sample_state(point_index);
 
-    spectrum.clear();
-    spectrum.reserve(s.size());
+    // only evaluate the visible wavelengths, directly into the output
+    size_t n_wavelengths = m_wavelengths.size();
+    spectrum.resize(n_wavelengths);
+    m_brdf.sample_state_spectrum(point_index, spectrum.data(), &m_visible_wavelengths);
 
+    size_t n_visible = 0;
     float max = -std::numeric_limits<float>::max();
-    for(size_t i = 0; i < s.size(); ++i)
+    for(size_t i = 0; i < n_wavelengths; ++i)
     {
-        if (m_wavelengths[i] > 360.0f && m_wavelengths[i] < 1000.0f)
+        if (m_visible_wavelengths[i])
         {
-            spectrum.push_back(s[i]);
-            max = std::max(max, s[i]);
+            spectrum[n_visible++] = spectrum[i];
+            max = std::max(max, spectrum[i]);
         }
     }
+    spectrum.resize(n_visible);
     float normalization = 0.9f / max;
     // normalize spectrum
     for(size_t i = 0; i < spectrum.size(); ++i)
@@ -0,0 +1,276 @@
+#include <tekari/catalog.h>
+
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <tbb/parallel_for.h>
+#include <tekari/data_io.h>
+#include <tekari/mapped_file.h>
+
+TEKARI_NAMESPACE_BEGIN
+
+namespace fs = std::filesystem;
+
+#define CATALOG_MAGIC "tekari_index"        // 13 bytes, including the terminating null character
+#define CATALOG_VERSION 1u
+
+static bool is_measurement_file(const fs::path& path)
+{
+    string name = path.filename().u8string();
+    return ends_with(name, ".txt") || ends_with(name, ".txt.gz") || ends_with(name, ".txt.zst") || ends_with(name, ".tkb");
+}
+
+bool CatalogQuery::matches(const CatalogEntry& entry) const
+{
+    if (!sample_name.empty() && entry.sample_name.find(sample_name) == string::npos)
+        return false;
+    if (!std::isnan(theta_in) && std::abs(entry.incident_angle[0] - theta_in) > angle_tolerance)
+        return false;
+    if (!std::isnan(phi_in) && std::abs(entry.incident_angle[1] - phi_in) > angle_tolerance)
+        return false;
+    if (data_type != ANY && entry.is_spectral != (data_type == SPECTRAL))
+        return false;
+    return true;
+}
+
+CatalogQuery parse_catalog_query(const string& query)
+{
+    CatalogQuery result;
+    std::istringstream fields(query);
+    string field;
+    while (std::getline(fields, field, ','))
+    {
+        field = trim_copy(field, [](int c) { return std::isspace(c); });
+        if (field.empty())
+            continue;
+
+        size_t separator = field.find('=');
+        string key = field.substr(0, separator);
+        string value = separator == string::npos ? "" : field.substr(separator + 1);
+
+        try {
+            if      (key == "sample")       result.sample_name = value;
+            else if (key == "theta")        result.theta_in = std::stof(value);
+            else if (key == "phi")          result.phi_in = std::stof(value);
+            else if (key == "tolerance")    result.angle_tolerance = std::stof(value);
+            else if (key == "spectral")     result.data_type = CatalogQuery::SPECTRAL;
+            else if (key == "standard")     result.data_type = CatalogQuery::STANDARD;
+            else
+                throw std::runtime_error("unknown field \"" + key + "\"");
+        } catch (const std::logic_error&) {
+            throw std::runtime_error("Invalid catalog query: bad value for \"" + key + "\"");
+        } catch (const std::runtime_error& e) {
+            throw std::runtime_error(string("Invalid catalog query: ") + e.what());
+        }
+    }
+    return result;
+}
+
+bool Catalog::load(const string& index_path)
+{
+    try {
+        if (!fs::exists(fs::u8path(index_path)))
+            return false;
+
+        MappedFile file(index_path);
+        const char* p = file.begin();
+        const char* end = file.end();
+        auto read = [&p, end](void* data, size_t size) {
+            if (size_t(end - p) < size)
+                throw std::runtime_error("truncated index file");
+            memcpy(data, p, size);
+            p += size;
+        };
+        auto read_u32 = [&read]() { uint32_t value; read(&value, sizeof(value)); return value; };
+        auto read_string = [&]() {
+            string value(read_u32(), '\0');
+            read(&value[0], value.size());
+            return value;
+        };
+
+        char magic[sizeof(CATALOG_MAGIC)];
+        read(magic, sizeof(magic));
+        if (memcmp(magic, CATALOG_MAGIC, sizeof(magic)) != 0 || read_u32() != CATALOG_VERSION)
+            throw std::runtime_error("not a catalog index (or an incompatible version)");
+
+        vector<CatalogEntry> entries(read_u32());
+        for (auto& entry : entries)
+        {
+            entry.path = read_string();
+            read(&entry.size, sizeof(entry.size));
+            read(&entry.mtime, sizeof(entry.mtime));
+            entry.sample_name = read_string();
+            read(&entry.incident_angle[0], sizeof(float));
+            read(&entry.incident_angle[1], sizeof(float));
+            entry.points_in_file = static_cast<int>(read_u32());
+            entry.is_spectral = read_u32() != 0;
+            entry.wavelengths.resize(read_u32());
+            read(entry.wavelengths.data(), entry.wavelengths.size() * sizeof(float));
+        }
+        m_entries = std::move(entries);
+    } catch (const std::exception& e) {
+        Log(Warning, "Unable to read catalog index \"%s\": %s\n", index_path.c_str(), e.what());
+        return false;
+    }
+    return true;
+}
+
+void Catalog::save(const string& index_path) const
+{
+    // write to a temporary file first, so that a concurrent reader never sees a partial index
+    fs::path path = fs::u8path(index_path);
+    fs::path temp_path = path;
+    temp_path += ".tmp" + to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+
+    FILE* file = fopen(temp_path.u8string().c_str(), "wb");
+    if (!file)
+        throw std::runtime_error("Unable to open file \"" + temp_path.u8string() + "\"");
+
+    auto write = [file](const void* data, size_t size) {
+        if (size != 0 && fwrite(data, 1, size, file) != size)
+            throw std::runtime_error("Unable to write catalog index");
+    };
+    auto write_u32 = [&write](uint32_t value) { write(&value, sizeof(value)); };
+    auto write_string = [&](const string& value) {
+        write_u32(static_cast<uint32_t>(value.size()));
+        write(value.data(), value.size());
+    };
+
+    try {
+        write(CATALOG_MAGIC, sizeof(CATALOG_MAGIC));
+        write_u32(CATALOG_VERSION);
+        write_u32(static_cast<uint32_t>(m_entries.size()));
+        for (const auto& entry : m_entries)
+        {
+            write_string(entry.path);
+            write(&entry.size, sizeof(entry.size));
+            write(&entry.mtime, sizeof(entry.mtime));
+            write_string(entry.sample_name);
+            write(&entry.incident_angle[0], sizeof(float));
+            write(&entry.incident_angle[1], sizeof(float));
+            write_u32(static_cast<uint32_t>(entry.points_in_file));
+            write_u32(entry.is_spectral ? 1 : 0);
+            write_u32(static_cast<uint32_t>(entry.wavelengths.size()));
+            write(entry.wavelengths.data(), entry.wavelengths.size() * sizeof(float));
+        }
+    } catch (...) {
+        fclose(file);
+        fs::remove(temp_path);
+        throw;
+    }
+    fclose(file);
+    fs::rename(temp_path, path);
+}
+
+void Catalog::scan(const vector<string>& roots)
+{
+    cout << std::setw(50) << std::left << "Scanning measurements .. ";
+    Timer<> timer;
+
+    // list the measurement files, with their current size and modification time
+    vector<CatalogEntry> entries;
+    auto add_file = [&entries](const fs::path& path) {
+        CatalogEntry entry;
+        entry.path = fs::canonical(path).u8string();
+        entry.size = static_cast<uint64_t>(fs::file_size(path));
+        entry.mtime = static_cast<int64_t>(fs::last_write_time(path).time_since_epoch().count());
+        entries.push_back(std::move(entry));
+    };
+    vector<string> scanned_directories;
+    for (const auto& root : roots)
+    {
+        fs::path root_path = fs::u8path(root);
+        if (fs::is_directory(root_path))
+        {
+            scanned_directories.push_back(fs::canonical(root_path).u8string() + static_cast<char>(fs::path::preferred_separator));
+            for (const auto& file : fs::recursive_directory_iterator(root_path))
+                if (file.is_regular_file() && is_measurement_file(file.path()))
+                    add_file(file.path());
+        }
+        else if (fs::is_regular_file(root_path))
+        {
+            add_file(root_path);
+        }
+        else
+        {
+            Log(Warning, "No such file or directory: \"%s\"\n", root.c_str());
+        }
+    }
+    std::sort(entries.begin(), entries.end(), [](const CatalogEntry& a, const CatalogEntry& b) { return a.path < b.path; });
+    entries.erase(std::unique(entries.begin(), entries.end(),
+        [](const CatalogEntry& a, const CatalogEntry& b) { return a.path == b.path; }), entries.end());
+
+    // reuse the entries of unchanged files, only read the metadata of new/modified ones
+    vector<uint8_t> valid(entries.size(), 0);
+    vector<size_t> to_read;
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        auto previous = std::lower_bound(m_entries.begin(), m_entries.end(), entries[i].path,
+            [](const CatalogEntry& entry, const string& path) { return entry.path < path; });
+        if (previous != m_entries.end() && previous->path == entries[i].path &&
+            previous->size == entries[i].size && previous->mtime == entries[i].mtime)
+        {
+            entries[i] = *previous;
+            valid[i] = 1;
+        }
+        else
+        {
+            to_read.push_back(i);
+        }
+    }
+
+    std::mutex log_mutex;
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, to_read.size(), 1),
+        [&](const tbb::blocked_range<size_t>& range)
+        {
+            for (size_t i = range.begin(); i != range.end(); ++i)
+            {
+                CatalogEntry& entry = entries[to_read[i]];
+                try {
+                    Metadata metadata;
+                    load_dataset_metadata(entry.path, entry.wavelengths, metadata);
+                    entry.sample_name = metadata.sample_name();
+                    entry.incident_angle = metadata.incident_angle();
+                    entry.points_in_file = metadata.points_in_file();
+                    entry.is_spectral = metadata.is_spectral();
+                    valid[to_read[i]] = 1;
+                } catch (const std::exception& e) {
+                    std::lock_guard<std::mutex> lock(log_mutex);
+                    Log(Warning, "Skipping \"%s\": %s\n", entry.path.c_str(), e.what());
+                }
+            }
+        }
+    );
+
+    // keep the previous entries of files that were not part of this scan
+    auto scanned = [&scanned_directories, &entries](const CatalogEntry& entry) {
+        for (const auto& directory : scanned_directories)
+            if (entry.path.compare(0, directory.size(), directory) == 0)
+                return true;
+        return std::binary_search(entries.begin(), entries.end(), entry,
+            [](const CatalogEntry& a, const CatalogEntry& b) { return a.path < b.path; });
+    };
+    vector<CatalogEntry> result;
+    for (auto& entry : m_entries)
+        if (!scanned(entry))
+            result.push_back(std::move(entry));
+    for (size_t i = 0; i < entries.size(); ++i)
+        if (valid[i])
+            result.push_back(std::move(entries[i]));
+    std::sort(result.begin(), result.end(), [](const CatalogEntry& a, const CatalogEntry& b) { return a.path < b.path; });
+    m_entries = std::move(result);
+
+    cout << "done. (" << to_read.size() << " read, " << m_entries.size() << " indexed, took "
+         << time_string(timer.value()) << ")" << endl;
+}
+
+vector<const CatalogEntry*> Catalog::query(const CatalogQuery& query) const
+{
+    vector<const CatalogEntry*> result;
+    for (const auto& entry : m_entries)
+        if (query.matches(entry))
+            result.push_back(&entry);
+    return result;
+}
+
+TEKARI_NAMESPACE_END
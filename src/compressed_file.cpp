@@ -0,0 +1,211 @@
+#include <tekari/compressed_file.h>
+
+#include <cstdio>
+
+#if defined(TEKARI_HAS_ZLIB)
+#  include <zlib.h>
+#endif
+#if defined(TEKARI_HAS_ZSTD)
+#  include <zstd.h>
+#endif
+
+TEKARI_NAMESPACE_BEGIN
+
+#define COMPRESSED_READ_SIZE (1 << 20)      // bytes read from the compressed file at once
+
+// Minimal RAII wrapper around a FILE
+class InputFile
+{
+public:
+    InputFile(const string& path)
+    :   m_file(fopen(path.c_str(), "rb"))
+    {
+        if (!m_file)
+            throw std::runtime_error("Unable to open file \"" + path + "\"");
+    }
+    ~InputFile() { fclose(m_file); }
+
+    InputFile(const InputFile&) = delete;
+    InputFile& operator=(const InputFile&) = delete;
+
+    inline size_t read(void* buffer, size_t size) { return fread(buffer, 1, size, m_file); }
+    inline bool error() const { return ferror(m_file) != 0; }
+    inline FILE* get() { return m_file; }
+
+private:
+    FILE* m_file;
+};
+
+Compression file_compression(const string& path)
+{
+    InputFile file(path);
+    unsigned char magic[4];
+    size_t n_read = file.read(magic, sizeof(magic));
+
+    if (n_read >= 2 && magic[0] == 0x1F && magic[1] == 0x8B)
+        return Compression::GZIP;
+    if (n_read == 4 && magic[0] == 0x28 && magic[1] == 0xB5 && magic[2] == 0x2F && magic[3] == 0xFD)
+        return Compression::ZSTD;
+    return Compression::NONE;
+}
+
+// make sure the buffer has some free space left (growing it geometrically), returning its first unused byte
+inline char* grow(vector<char>& data, size_t used)
+{
+    if (used == data.size())
+        data.resize(std::max(data.size() * 2, size_t(COMPRESSED_READ_SIZE)));
+    return data.data() + used;
+}
+
+#if defined(TEKARI_HAS_ZLIB)
+void decompress_gzip(const string& path, vector<char>& data, size_t max_size)
+{
+    InputFile file(path);
+
+    // gzip stores the (32 bits truncated) uncompressed size in its last 4 bytes,
+    // use it as a first guess for the output size
+    size_t used = data.size();
+    if (fseek(file.get(), -4, SEEK_END) == 0)
+    {
+        unsigned char size_bytes[4];
+        if (file.read(size_bytes, 4) == 4)
+            data.resize(used + std::min(max_size, size_t(size_bytes[0])       | size_t(size_bytes[1]) << 8 |
+                                                  size_t(size_bytes[2]) << 16 | size_t(size_bytes[3]) << 24) + 1);
+    }
+    fseek(file.get(), 0, SEEK_SET);
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    // 16 + MAX_WBITS: expect a gzip header
+    if (inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK)
+        throw std::runtime_error("Unable to initialize gzip decompression");
+
+    vector<unsigned char> input(COMPRESSED_READ_SIZE);
+    auto refill = [&]()
+    {
+        stream.avail_in = static_cast<uInt>(file.read(input.data(), input.size()));
+        stream.next_in = input.data();
+        if (file.error())
+            throw std::runtime_error("Error reading file \"" + path + "\"");
+        return stream.avail_in != 0;
+    };
+
+    int status = Z_OK;
+    try {
+        while (stream.avail_in != 0 || refill())
+        {
+            char* out = grow(data, used);
+            stream.next_out = reinterpret_cast<Bytef*>(out);
+            stream.avail_out = static_cast<uInt>(std::min<size_t>(data.size() - used, std::numeric_limits<uInt>::max()));
+            uInt avail_out = stream.avail_out;
+            status = inflate(&stream, Z_NO_FLUSH);
+            used += avail_out - stream.avail_out;
+            if (used >= max_size)
+                break;
+
+            if (status == Z_STREAM_END)
+            {
+                // concatenated gzip members are valid gzip files
+                if (stream.avail_in == 0 && !refill())
+                    break;
+                inflateReset(&stream);
+            }
+            else if (status != Z_OK && status != Z_BUF_ERROR)
+            {
+                throw std::runtime_error("Corrupted gzip file \"" + path + "\"");
+            }
+        }
+        if (status != Z_STREAM_END && used < max_size)
+            throw std::runtime_error("Truncated gzip file \"" + path + "\"");
+    } catch (...) {
+        inflateEnd(&stream);
+        throw;
+    }
+    inflateEnd(&stream);
+    data.resize(used);
+}
+#endif
+
+#if defined(TEKARI_HAS_ZSTD)
+void decompress_zstd(const string& path, vector<char>& data, size_t max_size)
+{
+    InputFile file(path);
+    ZSTD_DCtx* context = ZSTD_createDCtx();
+    if (!context)
+        throw std::runtime_error("Unable to initialize zstd decompression");
+
+    size_t used = data.size();
+    vector<char> input(std::max(ZSTD_DStreamInSize(), size_t(COMPRESSED_READ_SIZE)));
+    ZSTD_inBuffer in = { input.data(), 0, 0 };
+    size_t status = 0;
+    bool first_read = true;
+    bool output_full = false;
+    try {
+        while (true)
+        {
+            // the decompressor may still hold data when it filled the whole output buffer
+            if (in.pos == in.size && !output_full)
+            {
+                in.size = file.read(input.data(), input.size());
+                in.pos = 0;
+                if (file.error())
+                    throw std::runtime_error("Error reading file \"" + path + "\"");
+                if (in.size == 0)
+                    break;
+
+                // the frame header may know the uncompressed size
+                if (first_read)
+                {
+                    unsigned long long content_size = ZSTD_getFrameContentSize(input.data(), in.size);
+                    if (content_size != ZSTD_CONTENTSIZE_UNKNOWN && content_size != ZSTD_CONTENTSIZE_ERROR)
+                        data.resize(used + std::min(max_size, static_cast<size_t>(content_size)) + 1);
+                    first_read = false;
+                }
+            }
+
+            char* out_data = grow(data, used);
+            ZSTD_outBuffer out = { out_data, data.size() - used, 0 };
+            status = ZSTD_decompressStream(context, &out, &in);
+            if (ZSTD_isError(status))
+                throw std::runtime_error("Corrupted zstd file \"" + path + "\" (" + ZSTD_getErrorName(status) + ")");
+            used += out.pos;
+            output_full = out.pos == out.size;
+            if (used >= max_size)
+                break;
+        }
+        // a non-zero status means the last frame was not complete
+        if (status != 0 && used < max_size)
+            throw std::runtime_error("Truncated zstd file \"" + path + "\"");
+    } catch (...) {
+        ZSTD_freeDCtx(context);
+        throw;
+    }
+    ZSTD_freeDCtx(context);
+    data.resize(used);
+}
+#endif
+
+void decompress_file(const string& path, Compression compression, vector<char>& data, size_t max_size)
+{
+    switch (compression)
+    {
+        case Compression::GZIP:
+#if defined(TEKARI_HAS_ZLIB)
+            decompress_gzip(path, data, max_size);
+            break;
+#else
+            throw std::runtime_error("Unable to open \"" + path + "\": Tekari was built without gzip support");
+#endif
+        case Compression::ZSTD:
+#if defined(TEKARI_HAS_ZSTD)
+            decompress_zstd(path, data, max_size);
+            break;
+#else
+            throw std::runtime_error("Unable to open \"" + path + "\": Tekari was built without zstd support");
+#endif
+        case Compression::NONE:
+            throw std::runtime_error("File \"" + path + "\" is not compressed");
+    }
+}
+
+TEKARI_NAMESPACE_END
@@ -0,0 +1,244 @@
+#include <tekari/catalog.h>
+#include <tekari/data_io.h>
+
+#include <atomic>
+#include <filesystem>
+#include <mutex>
+#include <set>
+#include <thread>
+
+// Headless batch conversion between pgII text measurements and Tekari's binary datasets
+// (and indexing of measurement directories)
+
+namespace fs = std::filesystem;
+using namespace tekari;
+
+struct Conversion
+{
+    fs::path input;
+    fs::path output;
+};
+
+// suffix of a text measurement file name (empty if it isn't one)
+static string text_dataset_suffix(const fs::path& path)
+{
+    string name = path.filename().u8string();
+    for (const char* suffix : { ".txt", ".txt.gz", ".txt.zst" })
+        if (ends_with(name, suffix))
+            return suffix;
+    return string();
+}
+
+static bool is_text_dataset(const fs::path& path) { return !text_dataset_suffix(path).empty(); }
+
+static bool is_binary_dataset(const fs::path& path) { return path.extension() == ".tkb"; }
+
+// name of the converted file: "a.txt(.gz|.zst)" <-> "a.tkb"
+static fs::path converted_name(const fs::path& input)
+{
+    string name = input.filename().u8string();
+    if (is_binary_dataset(input))
+        return fs::u8path(name.substr(0, name.size() - 4) + ".txt");
+    return fs::u8path(name.substr(0, name.size() - text_dataset_suffix(input).size()) + ".tkb");
+}
+
+static void print_usage()
+{
+    cout << "Usage: tekari-convert [-o <output directory>] [-p 16|32] [-j <workers>] [-f] [-t] <file or directory> ..." << endl;
+    cout << "       tekari-convert -i <index> <file or directory> ..." << endl;
+    cout << "Converts pgII text measurements (.txt, .txt.gz, .txt.zst) to binary datasets (.tkb), or back with -t." << endl;
+    cout << "Directories are converted recursively." << endl;
+    cout << "Options:" << endl;
+    cout << "   -o      Write the converted files into this directory (mirroring the input trees)." << endl;
+    cout << "           By default, they are written next to their input." << endl;
+    cout << "   -p      Precision of the binary intensities, in bits (default 32, angles are always 32 bits)." << endl;
+    cout << "   -j      Number of files converted concurrently (default: number of cores)." << endl;
+    cout << "   -f      Overwrite existing files (they are skipped otherwise)." << endl;
+    cout << "   -t      Convert binary datasets to text measurements instead (text inputs are then ignored)." << endl;
+    cout << "   -i      Instead of converting, update the catalog index <index> with the metadata" << endl;
+    cout << "           of every measurement found (see tekari -i)." << endl;
+}
+
+int main(int argc, char** argv)
+{
+    vector<string> inputs;
+    string output_directory;
+    string index_path;
+    BinaryPrecision precision = BinaryPrecision::FLOAT32;
+    size_t n_workers = std::max(1u, std::thread::hardware_concurrency());
+    bool overwrite = false;
+    bool to_text = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if ((arg == "-o" || arg == "-p" || arg == "-j" || arg == "-i") && i + 1 == argc)
+        {
+            cerr << "Missing value for option " << arg << endl;
+            return 1;
+        }
+
+        if (arg == "-o")
+        {
+            output_directory = argv[++i];
+        }
+        else if (arg == "-p")
+        {
+            string bits = argv[++i];
+            if (bits != "16" && bits != "32")
+            {
+                cerr << "Invalid precision \"" << bits << "\" (expected 16 or 32)" << endl;
+                return 1;
+            }
+            precision = bits == "16" ? BinaryPrecision::FLOAT16 : BinaryPrecision::FLOAT32;
+        }
+        else if (arg == "-j")
+        {
+            n_workers = std::max(1, atoi(argv[++i]));
+        }
+        else if (arg == "-i")
+        {
+            index_path = argv[++i];
+        }
+        else if (arg == "-f")
+        {
+            overwrite = true;
+        }
+        else if (arg == "-t")
+        {
+            to_text = true;
+        }
+        else if (arg == "-h" || arg == "--help")
+        {
+            print_usage();
+            return 0;
+        }
+        else
+        {
+            inputs.push_back(arg);
+        }
+    }
+    if (inputs.empty())
+    {
+        print_usage();
+        return 1;
+    }
+
+    if (!index_path.empty())
+    {
+        try {
+            Catalog catalog;
+            catalog.load(index_path);
+            catalog.scan(inputs);
+            catalog.save(index_path);
+        } catch (const std::exception& e) {
+            cerr << "Unable to update the index \"" << index_path << "\": " << e.what() << endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    // gather every file to convert, in a single direction so that no output can be an input of the run
+    auto is_input = [to_text](const fs::path& file) { return to_text ? is_binary_dataset(file) : is_text_dataset(file); };
+    vector<Conversion> conversions;
+    try {
+        for (const auto& input : inputs)
+        {
+            fs::path input_path = fs::u8path(input);
+            fs::path output_root = output_directory.empty() ? fs::path() : fs::u8path(output_directory);
+            auto add_conversion = [&](const fs::path& file, const fs::path& relative_directory) {
+                if (!is_input(file))
+                    return;
+                fs::path directory = output_root.empty() ? file.parent_path() : output_root / relative_directory;
+                conversions.push_back(Conversion{ file, directory / converted_name(file) });
+            };
+
+            if (fs::is_directory(input_path))
+            {
+                for (const auto& entry : fs::recursive_directory_iterator(input_path))
+                    if (entry.is_regular_file())
+                        add_conversion(entry.path(), entry.path().parent_path().lexically_relative(input_path.parent_path()));
+            }
+            else if (fs::exists(input_path))
+            {
+                if (!is_input(input_path))
+                {
+                    cerr << "Not a " << (to_text ? "binary dataset" : "text measurement") << ": \"" << input << "\"" << endl;
+                    return 1;
+                }
+                add_conversion(input_path, fs::path());
+            }
+            else
+            {
+                cerr << "No such file or directory: \"" << input << "\"" << endl;
+                return 1;
+            }
+        }
+    } catch (const std::exception& e) {
+        cerr << "Unable to list the files to convert: " << e.what() << endl;
+        return 1;
+    }
+
+    // several inputs converted to the same file (e.g. "a.txt" and "a.txt.gz") would be written concurrently
+    std::set<fs::path> outputs;
+    for (const auto& conversion : conversions)
+    {
+        if (!outputs.insert(conversion.output.lexically_normal()).second)
+        {
+            cerr << "Several inputs would be converted to \"" << conversion.output.u8string() << "\"" << endl;
+            return 1;
+        }
+    }
+
+    // the workers report each conversion themselves, under the output mutex
+    set_dataset_io_verbose(false);
+
+    // convert them concurrently
+    std::atomic<size_t> next_conversion{ 0 };
+    std::atomic<size_t> n_failed{ 0 }, n_skipped{ 0 };
+    std::mutex output_mutex;
+    Timer<> timer;
+
+    auto worker = [&]()
+    {
+        for (size_t i = next_conversion++; i < conversions.size(); i = next_conversion++)
+        {
+            const Conversion& conversion = conversions[i];
+            string message;
+            try {
+                if (!overwrite && fs::exists(conversion.output))
+                {
+                    ++n_skipped;
+                    continue;
+                }
+                fs::create_directories(conversion.output.parent_path());
+
+                Timer<> conversion_timer;
+                RawMeasurement raw_measurement;
+                Matrix2Xf V2D;
+                VectorXf wavelengths;
+                Metadata metadata;
+                load_dataset(conversion.input.u8string(), raw_measurement, V2D, wavelengths, metadata);
+                save_dataset(conversion.output.u8string(), raw_measurement, metadata, precision);
+                message = conversion.input.u8string() + " -> " + conversion.output.u8string() +
+                          " (took " + time_string(conversion_timer.value()) + ")";
+            } catch (const std::exception& e) {
+                ++n_failed;
+                message = "Unable to convert \"" + conversion.input.u8string() + "\": " + e.what();
+            }
+            std::lock_guard<std::mutex> lock(output_mutex);
+            cout << message << endl;
+        }
+    };
+
+    vector<std::thread> workers;
+    for (size_t i = 1; i < std::min(n_workers, conversions.size()); ++i)
+        workers.emplace_back(worker);
+    worker();
+    for (auto& w : workers)
+        w.join();
+
+    cout << conversions.size() - n_failed - n_skipped << " file(s) converted, "
+         << n_skipped << " skipped, " << n_failed << " failed (took " << time_string(timer.value()) << ")" << endl;
+    return n_failed == 0 ? 0 : 1;
+}
@@ -1,217 +1,871 @@
 #include <tekari/data_io.h>
 
-#include <unordered_set>
-#include <fstream>
+#include <charconv>
+#include <mutex>
+#include <tbb/parallel_for.h>
+#include <tekari/compressed_file.h>
+#include <tekari/float16.h>
+#include <tekari/mapped_file.h>
 #include <tekari/selections.h>
 
 TEKARI_NAMESPACE_BEGIN
 
-struct Vector2f_hash
+#define PARSING_CHUNK_SIZE (1 << 20)     // bytes of the data section parsed by each task
+#define RADIX_SORT_BLOCK_SIZE (1 << 16)  // keys handled by each task of a radix sort pass
+#define PARSING_WAVE_SIZE 16             // chunks parsed between two progress reports
+#define LOADING_REPORT_INTERVAL (1 << 16) // points parsed between two progress reports (sequential loaders)
+#define METADATA_MAX_SIZE (1 << 20)      // bytes decompressed to read the metadata of a compressed dataset
+#define SAVING_BLOCK_SIZE 1024           // points formatted by each task when saving
+#define SAVING_WAVE_SIZE 64              // blocks formatted before being written to the file
+
+#define BINARY_MAGIC "tekari_data"       // 12 bytes, including the terminating null character
+#define BINARY_VERSION 2u                // version 1 had no value type (always float32)
+#define BINARY_EXTENSION ".tkb"
+
+static bool s_verbose = true;
+
+void set_dataset_io_verbose(bool verbose) { s_verbose = verbose; }
+bool dataset_io_verbose() { return s_verbose; }
+
+// ============= Parsing helpers (work directly on the file bytes) =============
+
+inline bool is_blank(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f'; }
+
+inline const char* skip_blanks(const char* p, const char* end)
+{
+    while (p != end && is_blank(*p))
+        ++p;
+    return p;
+}
+
+inline const char* find_line_end(const char* p, const char* end)
+{
+    const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+    return eol ? eol : end;
+}
+
+// parse the next float of the line, skipping leading blanks (p is moved past the value)
+inline bool parse_float(const char*& p, const char* end, float& value)
 {
-    size_t operator()(const Vector2f& v) const {
-        size_t hash1 = std::hash<Vector2f::Value>()(v[0]);
-        size_t hash2 = std::hash<Vector2f::Value>()(v[1]);
-        return hash1 ^ (hash2 << 1);
+    p = skip_blanks(p, end);
+    if (p != end && *p == '+')
+        ++p;
+#if defined(__cpp_lib_to_chars)
+    auto result = std::from_chars(p, end, value);
+    if (result.ec != std::errc())
+        return false;
+    p = result.ptr;
+    return true;
+#else
+    // no floating point from_chars available, copy the token to a null-terminated buffer
+    char buffer[64];
+    size_t length = 0;
+    while (p + length != end && length < sizeof(buffer) - 1 && !is_blank(p[length]) && p[length] != '\n')
+    {
+        buffer[length] = p[length];
+        ++length;
     }
-};
+    buffer[length] = '\0';
+    char* token_end;
+    value = strtof(buffer, &token_end);
+    if (token_end == buffer)
+        return false;
+    p += token_end - buffer;
+    return true;
+#endif
+}
 
 void load_standard_dataset(
-    std::ifstream& file,
+    const char* begin,
+    const char* end,
     RawMeasurement& raw_measurement,
     Matrix2Xf& V2D,
-    Metadata& metadata
+    Metadata& metadata,
+    const LoadingObserver* observer
 );
 void load_spectral_dataset(
-    std::ifstream& file,
+    const char* begin,
+    const char* end,
     RawMeasurement& raw_measurement,
     Matrix2Xf& V2D,
+    Metadata& metadata,
+    const LoadingObserver* observer
+);
+void load_binary_dataset(
+    const char* begin,
+    const char* end,
+    RawMeasurement& raw_measurement,
+    Matrix2Xf& V2D,
+    VectorXf& wavelengths,
     Metadata& metadata
 );
+const char* read_binary_metadata(const char* begin, const char* end, Metadata& metadata, uint32_t& precision);
+
+// read the metadata (leading comment lines), returns the beginning of the data section
+const char* read_text_metadata(const char* p, const char* end, Metadata& metadata)
+{
+    while (p < end)
+    {
+        const char* eol = find_line_end(p, end);
+        if (*p == '#')
+        {
+            const char* line_end = eol;
+            if (line_end != p && line_end[-1] == '\r')
+                --line_end;
+            metadata.add_line(string(p, line_end));
+        }
+        else if (skip_blanks(p, eol) != eol)
+        {
+            break;
+        }
+        p = eol + 1;
+    }
+    return std::min(p, end);
+}
+
+void load_text_dataset(
+    const char* p,
+    const char* end,
+    RawMeasurement& raw_measurement,
+    Matrix2Xf& V2D,
+    VectorXf& wavelengths,
+    Metadata& metadata,
+    const LoadingObserver* observer
+)
+{
+    p = read_text_metadata(p, end, metadata);
+    if (p < end)
+    {
+        metadata.init_infos(wavelengths);
+        if (metadata.is_spectral())
+            load_spectral_dataset(p, end, raw_measurement, V2D, metadata, observer);
+        else
+            load_standard_dataset(p, end, raw_measurement, V2D, metadata, observer);
+    }
+}
+
+// Give access to the bytes of a dataset file: the file is mapped, unless it is compressed, in which
+// case it is streamed through its decompressor into memory (stopping after max_decompressed_size bytes)
+void open_dataset_file(
+    const string& file_name,
+    std::unique_ptr<MappedFile>& file,
+    vector<char>& decompressed,
+    const char*& begin,
+    const char*& end,
+    size_t max_decompressed_size = std::numeric_limits<size_t>::max()
+)
+{
+    Compression compression = file_compression(file_name);
+    if (compression == Compression::NONE)
+    {
+        file = std::make_unique<MappedFile>(file_name);
+        begin = file->begin();
+        end = file->end();
+    }
+    else
+    {
+        decompress_file(file_name, compression, decompressed, max_decompressed_size);
+        begin = decompressed.data();
+        end = begin + decompressed.size();
+    }
+}
+
+inline bool is_binary_dataset(const char* begin, const char* end)
+{
+    return size_t(end - begin) >= sizeof(BINARY_MAGIC) && memcmp(begin, BINARY_MAGIC, sizeof(BINARY_MAGIC)) == 0;
+}
 
 void load_dataset(
     const string& file_name,
     RawMeasurement& raw_measurement,
     Matrix2Xf& V2D,
     VectorXf& wavelengths,
-    Metadata& metadata
+    Metadata& metadata,
+    const LoadingObserver* observer
 )
 {
-    cout << std::setw(50) << std::left << "Loading dataset .. ";
+    if (s_verbose)
+        cout << std::setw(50) << std::left << "Loading dataset .. ";
     Timer<> timer;
 
-    // try open file
-    std::ifstream file(file_name);
-    if (!file)
-        throw std::runtime_error("Unable to open file \"" + file_name + "\"");
+    // map the whole file, the loaders parse its bytes in place
+    std::unique_ptr<MappedFile> file;
+    vector<char> decompressed;
+    const char* p;
+    const char* end;
+    open_dataset_file(file_name, file, decompressed, p, end);
+    const size_t data_size = end - p;
+
+    if (is_binary_dataset(p, end))
+        load_binary_dataset(p, end, raw_measurement, V2D, wavelengths, metadata);
+    else
+        load_text_dataset(p, end, raw_measurement, V2D, wavelengths, metadata, observer);
+
+    if (observer && observer->progress)
+        observer->progress(1.0f);
+
+    size_t elapsed = timer.value();
+    if (s_verbose)
+        cout << "done. (took " <<  time_string(elapsed) << ", "
+         << mem_string(size_t(data_size * 1e6 / std::max(elapsed, size_t(1)))) << "/s)" << endl;
+}
+
+void load_dataset_metadata(
+    const string& file_name,
+    VectorXf& wavelengths,
+    Metadata& metadata
+)
+{
+    std::unique_ptr<MappedFile> file;
+    vector<char> decompressed;
+    const char* p;
+    const char* end;
+    open_dataset_file(file_name, file, decompressed, p, end, METADATA_MAX_SIZE);
+
+    if (is_binary_dataset(p, end))
+    {
+        uint32_t precision;
+        read_binary_metadata(p, end, metadata, precision);
+    }
+    else if (read_text_metadata(p, end, metadata) == end && decompressed.size() >= METADATA_MAX_SIZE)
+    {
+        throw std::runtime_error("Metadata too large (or no data found)");
+    }
+    metadata.init_infos(wavelengths);
+}
 
-    size_t line_number = 0;
-    for (string line; getline(file, line); )
+// ============= Duplicate points removal =============
+
+// Stable LSD radix sort of 64 bit keys (with their payload), one byte per pass.
+// Each pass builds per-block histograms and scatters the blocks in parallel.
+void radix_sort(vector<uint64_t>& keys, vector<uint32_t>& values)
+{
+    const size_t n = keys.size();
+    const size_t n_blocks = std::max<size_t>(1, (n + RADIX_SORT_BLOCK_SIZE - 1) / RADIX_SORT_BLOCK_SIZE);
+
+    vector<uint64_t> keys_out(n);
+    vector<uint32_t> values_out(n);
+    vector<size_t> offsets(n_blocks * 256);
+
+    for (int shift = 0; shift < 64; shift += 8)
     {
-        ++line_number;
+        std::fill(offsets.begin(), offsets.end(), 0);
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, n_blocks, 1),
+            [&](const tbb::blocked_range<size_t>& range)
+            {
+                for (size_t b = range.begin(); b != range.end(); ++b)
+                {
+                    size_t* histogram = &offsets[b * 256];
+                    for (size_t i = b * RADIX_SORT_BLOCK_SIZE; i < std::min(n, (b + 1) * RADIX_SORT_BLOCK_SIZE); ++i)
+                        ++histogram[(keys[i] >> shift) & 0xFF];
+                }
+            }
+        );
 
-        if (line.empty())
+        // turn the histograms into scatter offsets (digit major, block minor keeps the sort stable)
+        size_t sum = 0;
+        bool trivial_pass = false;
+        for (size_t digit = 0; digit < 256; ++digit)
         {
+            size_t digit_start = sum;
+            for (size_t b = 0; b < n_blocks; ++b)
+            {
+                size_t count = offsets[b * 256 + digit];
+                offsets[b * 256 + digit] = sum;
+                sum += count;
+            }
+            trivial_pass |= sum - digit_start == n;
+        }
+        // every key has the same digit, nothing would move
+        if (trivial_pass)
             continue;
+
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, n_blocks, 1),
+            [&](const tbb::blocked_range<size_t>& range)
+            {
+                for (size_t b = range.begin(); b != range.end(); ++b)
+                {
+                    size_t* offset = &offsets[b * 256];
+                    for (size_t i = b * RADIX_SORT_BLOCK_SIZE; i < std::min(n, (b + 1) * RADIX_SORT_BLOCK_SIZE); ++i)
+                    {
+                        size_t o = offset[(keys[i] >> shift) & 0xFF]++;
+                        keys_out[o] = keys[i];
+                        values_out[o] = values[i];
+                    }
+                }
+            }
+        );
+        keys.swap(keys_out);
+        values.swap(values_out);
+    }
+}
+
+// Remove the points sharing the exact same (theta, phi) coordinates, keeping the first
+// occurrence of each and the original ordering. Returns the number of removed points.
+size_t remove_duplicate_points(RawMeasurement& raw_measurement)
+{
+    const size_t n_points = raw_measurement.n_sample_points();
+    if (n_points < 2)
+        return 0;
+
+    // pack the coordinates into sortable keys (+0.0f turns -0 into 0, as they compare equal)
+    vector<uint64_t> keys(n_points);
+    vector<uint32_t> indices(n_points);
+    const RawMeasurement::Row thetas = raw_measurement.theta();
+    const RawMeasurement::Row phis = raw_measurement.phi();
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, n_points, GRAIN_SIZE),
+        [&](const tbb::blocked_range<size_t>& range)
+        {
+            for (size_t i = range.begin(); i != range.end(); ++i)
+            {
+                float theta = thetas[i] + 0.0f, phi = phis[i] + 0.0f;
+                uint32_t theta_bits, phi_bits;
+                memcpy(&theta_bits, &theta, sizeof(float));
+                memcpy(&phi_bits, &phi, sizeof(float));
+                keys[i] = (uint64_t(theta_bits) << 32) | phi_bits;
+                indices[i] = static_cast<uint32_t>(i);
+            }
+        }
+    );
+
+    radix_sort(keys, indices);
+
+    // the sort is stable: in a run of equal keys, the first index is the first occurrence
+    vector<uint8_t> keep(n_points, 1);
+    size_t n_duplicates = 0;
+    for (size_t i = 1; i < n_points; ++i)
+    {
+        if (keys[i] == keys[i - 1])
+        {
+            keep[indices[i]] = 0;
+            ++n_duplicates;
         }
-        if (line[0] == '#')
+    }
+    if (n_duplicates == 0)
+        return 0;
+
+    // compact every row in place
+    const size_t n_rows = raw_measurement.n_wavelengths() + 3;
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, n_rows, 1),
+        [&](const tbb::blocked_range<size_t>& range)
         {
-            metadata.add_line(line);
+            for (size_t r = range.begin(); r != range.end(); ++r)
+            {
+                RawMeasurement::Row row = raw_measurement[r];
+                size_t last_valid = 0;
+                for (size_t i = 0; i < n_points; ++i)
+                    if (keep[i])
+                        row[last_valid++] = row[i];
+            }
         }
-        else
+    );
+    raw_measurement.conservative_resize(raw_measurement.n_wavelengths(), n_points - n_duplicates);
+
+    return n_duplicates;
+}
+
+// Remove duplicates, compute the 2D coordinates and update the point count of the metadata
+void finalize_points(
+    RawMeasurement& raw_measurement,
+    Matrix2Xf& V2D,
+    Metadata& metadata,
+    bool report_duplicates = true
+)
+{
+    size_t n_duplicates = remove_duplicate_points(raw_measurement);
+    if (report_duplicates && n_duplicates != 0)
+        Log(Warning, "found %zu points with exact same coordinates (only the first occurrence of each was kept)\n", n_duplicates);
+
+    const size_t n_points = raw_measurement.n_sample_points();
+    V2D.resize(n_points);
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, n_points, GRAIN_SIZE),
+        [&](const tbb::blocked_range<size_t>& range)
         {
-            file.seekg(0);
+            for (size_t i = range.begin(); i != range.end(); ++i)
+                V2D[i] = hemisphere_to_disk(Vector2f{ raw_measurement.theta()[i], raw_measurement.phi()[i] });
+        }
+    );
+    metadata.set_points_in_file(n_points);
+}
 
-            metadata.init_infos(wavelengths);
-            if (metadata.is_spectral())
-                load_spectral_dataset(file, raw_measurement, V2D, metadata);
-            else
-                load_standard_dataset(file, raw_measurement, V2D, metadata);
-            break;
+inline void report_loading_progress(
+    const LoadingObserver* observer,
+    float progress,
+    const RawMeasurement& raw_measurement,
+    size_t n_points,
+    const Metadata& metadata
+)
+{
+    if (observer->progress)
+        observer->progress(progress);
+    if (observer->snapshot)
+        observer->snapshot(raw_measurement, n_points, metadata);
+}
+
+void copy_preview_points(
+    const RawMeasurement& raw_measurement,
+    size_t n_points,
+    size_t max_points,
+    RawMeasurement& preview
+)
+{
+    const size_t stride = std::max<size_t>(1, (n_points + max_points - 1) / std::max<size_t>(max_points, 1));
+    const size_t n_preview_points = (n_points + stride - 1) / stride;
+
+    preview.resize(raw_measurement.n_wavelengths(), n_preview_points);
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, raw_measurement.n_wavelengths() + 3, 1),
+        [&](const tbb::blocked_range<size_t>& range)
+        {
+            for (size_t r = range.begin(); r != range.end(); ++r)
+                for (size_t i = 0; i < n_preview_points; ++i)
+                    preview(r, i) = raw_measurement(r, i * stride);
         }
-    }
-    cout << "done. (took " <<  time_string(timer.value()) << ")" << endl;
+    );
 }
 
+void finalize_preview(
+    RawMeasurement& preview,
+    Matrix2Xf& V2D,
+    Metadata& metadata
+)
+{
+    finalize_points(preview, V2D, metadata, false);
+}
+
+// ============= Loaders =============
+
 void load_standard_dataset(
-    std::ifstream& file,
+    const char* begin,
+    const char* end,
     RawMeasurement& raw_measurement,
     Matrix2Xf& V2D,
-    Metadata& metadata
+    Metadata& metadata,
+    const LoadingObserver* observer
 )
 {
-    std::unordered_set<Vector2f, Vector2f_hash> read_vertices;
+    size_t max_points = static_cast<size_t>(metadata.points_in_file());
+    raw_measurement.resize(0, max_points);
 
-    V2D.resize(metadata.points_in_file());
-    raw_measurement.resize(0, metadata.points_in_file());
+    RawMeasurement::Row thetas = raw_measurement.theta();
+    RawMeasurement::Row phis = raw_measurement.phi();
+    RawMeasurement::Row luminances = raw_measurement.luminance();
 
-    size_t line_number = 0;
     size_t n_points = 0;
-    for (string line; getline(file, line); )
+    for (const char* p = begin; p < end; ++p)
     {
-        ++line_number;
-        trim(line);
+        const char* eol = find_line_end(p, end);
+        p = skip_blanks(p, eol);
 
-        if (line.empty() || line[0] == '#')
+        if (p == eol || *p == '#')
         {
             // skip empty/comment lines
         }
         else
         {
             float theta, phi, luminance;
-            if (sscanf(line.c_str(), "%f %f %f", &theta, &phi, &luminance) != 3)
+            if (!parse_float(p, eol, theta) ||
+                !parse_float(p, eol, phi) ||
+                !parse_float(p, eol, luminance))
             {
                 throw std::runtime_error("Error reading file");
             }
+            if (n_points == max_points)
+                throw std::runtime_error("Invalid standard data format (more points than announced)");
             if (theta > 90)
                 theta = 180.f - theta;
 
-            Vector2f p2d = Vector2f{ theta, phi };
-            if (read_vertices.count(p2d) != 0)
-            {
-                cerr << "Warning: found two points with exact same coordinates\n";
-                continue;
-            }
-            read_vertices.insert(p2d);
-            Vector2f transformed_point = hemisphere_to_disk(p2d);
-            raw_measurement.set_theta(n_points, theta);
-            raw_measurement.set_phi(n_points, phi);
-            raw_measurement.set_luminance(n_points, luminance);
-            V2D[n_points] = transformed_point;
+            thetas[n_points] = theta;
+            phis[n_points] = phi;
+            luminances[n_points] = luminance;
             ++n_points;
+
+            if (observer && n_points % LOADING_REPORT_INTERVAL == 0)
+                report_loading_progress(observer, float(eol - begin) / (end - begin), raw_measurement, n_points, metadata);
         }
+        p = eol;
     }
+
+    if (n_points != max_points)
+        raw_measurement.conservative_resize(0, n_points);
+
+    finalize_points(raw_measurement, V2D, metadata);
 }
-void load_spectral_dataset(
-    std::ifstream& file,
-    RawMeasurement& raw_measurement,
-    Matrix2Xf& V2D,
-    Metadata& metadata
-)
+
+// Newline-aligned slice of the data section
+struct SpectralChunk
 {
-    size_t n_wavelengths = static_cast<size_t>(metadata.data_points_per_loop());
+    const char* begin;
+    const char* end;
+    size_t n_points = 0;
+    size_t offset = 0;      // index of the chunk's first point in the whole measurement
+};
 
-    std::unordered_set<Vector2f, Vector2f_hash> read_vertices;
-    vector<vector<float>> raw_m(n_wavelengths + 3);
+// number of data lines (neither empty nor comments) in [begin, end)
+size_t count_data_lines(const char* begin, const char* end)
+{
+    size_t n_lines = 0;
+    for (const char* p = begin; p < end; ++p)
+    {
+        const char* eol = find_line_end(p, end);
+        p = skip_blanks(p, eol);
+        if (p != eol && *p != '#')
+            ++n_lines;
+        p = eol;
+    }
+    return n_lines;
+}
 
+// parse the chunk's points directly into their final place in the measurement
+void parse_spectral_chunk(const SpectralChunk& chunk, RawMeasurement& raw_measurement)
+{
+    const size_t n_wavelengths = raw_measurement.n_wavelengths();
+    size_t index = chunk.offset;
 
-    size_t line_number = 0;
-    size_t n_points = 0;
-    for (string line; getline(file, line); )
+    for (const char* p = chunk.begin; p < chunk.end; ++p)
     {
-        ++line_number;
-        trim(line);
+        const char* eol = find_line_end(p, chunk.end);
+        p = skip_blanks(p, eol);
 
-        if (line.empty() || line[0] == '#')
+        if (p == eol || *p == '#')
         {
             // skip empty/comment lines
         }
         else
         {
-            std::istringstream line_stream{ line };
-            Vector2f angles;
-            line_stream >> angles[0] >> angles[1];
-            if (read_vertices.count(angles) > 0)
+            float theta, phi;
+            if (!parse_float(p, eol, theta) ||
+                !parse_float(p, eol, phi))
             {
-                Log(Warning, "%s\n", "found two points with exact same coordinates");
-                continue;                                   // skip similar points
+                throw std::runtime_error("Error reading file");
             }
-            if (angles[0] > 90)
-                angles[0] = 180.f - angles[0];
-            read_vertices.insert(angles);
-
-            V2D.push_back(hemisphere_to_disk(angles));
+            if (theta > 90)
+                theta = 180.f - theta;
+            raw_measurement.set_theta(index, theta);
+            raw_measurement.set_phi(index, phi);
 
-            raw_m[0].push_back(angles[0]);
-            raw_m[1].push_back(angles[1]);
-            for (size_t i = 0; i < n_wavelengths; ++i)
+            for (size_t w = 0; w < n_wavelengths; ++w)
             {
                 float intensity;
-                line_stream >> intensity;
-                raw_m[i+3].push_back(intensity);
+                if (!parse_float(p, eol, intensity))
+                    throw std::runtime_error("Error reading file");
+                raw_measurement(w + 3, index) = intensity;
             }
-            raw_m[2].push_back(raw_m[3][n_points]);     // TODO: compute luminance
-            ++n_points;
+            raw_measurement.set_luminance(index, raw_measurement(3, index));   // TODO: compute luminance
+            ++index;
         }
+        p = eol;
+    }
+}
+
+void load_spectral_dataset(
+    const char* begin,
+    const char* end,
+    RawMeasurement& raw_measurement,
+    Matrix2Xf& V2D,
+    Metadata& metadata,
+    const LoadingObserver* observer
+)
+{
+    size_t n_wavelengths = static_cast<size_t>(metadata.data_points_per_loop());
+
+    // split the data section into newline-aligned chunks
+    vector<SpectralChunk> chunks;
+    for (const char* p = begin; p < end; )
+    {
+        const char* chunk_end = end - p > PARSING_CHUNK_SIZE ? find_line_end(p + PARSING_CHUNK_SIZE, end) : end;
+        chunk_end = std::min(chunk_end + 1, end);
+        chunks.emplace_back();
+        chunks.back().begin = p;
+        chunks.back().end = chunk_end;
+        p = chunk_end;
     }
-    metadata.set_points_in_file(n_points);
 
+    // count the points of each chunk first, so that the measurement is allocated only once
+    // and every chunk knows where its points go
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, chunks.size(), 1),
+        [&](const tbb::blocked_range<size_t>& range)
+        {
+            for (size_t c = range.begin(); c != range.end(); ++c)
+                chunks[c].n_points = count_data_lines(chunks[c].begin, chunks[c].end);
+        }
+    );
+    size_t n_points = 0;
+    for (auto& chunk : chunks)
+    {
+        chunk.offset = n_points;
+        n_points += chunk.n_points;
+    }
     raw_measurement.resize(n_wavelengths, n_points);
-    for (size_t i = 0; i < n_wavelengths+3; ++i)
+
+    // parse every chunk on its own, all at once or, to report the progress, wave by wave
+    // (each wave completes the points preceding the next one)
+    const size_t wave_size = observer ? PARSING_WAVE_SIZE : chunks.size();
+    std::exception_ptr parsing_error;
+    std::mutex parsing_error_mutex;
+    for (size_t wave_begin = 0; wave_begin < chunks.size(); wave_begin += wave_size)
+    {
+        size_t wave_end = std::min(chunks.size(), wave_begin + wave_size);
+        tbb::parallel_for(tbb::blocked_range<size_t>(wave_begin, wave_end, 1),
+            [&](const tbb::blocked_range<size_t>& range)
+            {
+                for (size_t c = range.begin(); c != range.end(); ++c)
+                {
+                    try {
+                        parse_spectral_chunk(chunks[c], raw_measurement);
+                    } catch (...) {
+                        std::lock_guard<std::mutex> lock(parsing_error_mutex);
+                        parsing_error = std::current_exception();
+                    }
+                }
+            }
+        );
+        if (parsing_error)
+            std::rethrow_exception(parsing_error);
+
+        const SpectralChunk& last_chunk = chunks[wave_end - 1];
+        if (observer && wave_end != chunks.size())
+            report_loading_progress(observer, float(last_chunk.end - begin) / (end - begin),
+                                    raw_measurement, last_chunk.offset + last_chunk.n_points, metadata);
+    }
+
+    finalize_points(raw_measurement, V2D, metadata);
+}
+
+// Reads everything up to the dimensions of the measurement, returns the position following the metadata
+const char* read_binary_metadata(const char* begin, const char* end, Metadata& metadata, uint32_t& precision)
+{
+    const char* p = begin;
+    auto read = [&p, end](void* data, size_t size) {
+        if (size_t(end - p) < size)
+            throw std::runtime_error("Invalid binary data format (truncated file)");
+        memcpy(data, p, size);
+        p += size;
+    };
+    auto read_u32 = [&read]() { uint32_t value; read(&value, sizeof(value)); return value; };
+
+    p += sizeof(BINARY_MAGIC);
+    uint32_t version = read_u32();
+    if (version != 1 && version != BINARY_VERSION)
+        throw std::runtime_error("Invalid binary data format (unsupported version)");
+    precision = version == 1 ? uint32_t(BinaryPrecision::FLOAT32) : read_u32();
+    if (precision != uint32_t(BinaryPrecision::FLOAT32) && precision != uint32_t(BinaryPrecision::FLOAT16))
+        throw std::runtime_error("Invalid binary data format (unknown value type)");
+
+    uint32_t n_lines = read_u32();
+    for (uint32_t i = 0; i < n_lines; ++i)
     {
-        memcpy(raw_measurement[i].data(), raw_m[i].data(), n_points * sizeof(float));
+        string line(read_u32(), '\0');
+        read(&line[0], line.size());
+        metadata.add_line(line);
+    }
+    return p;
+}
+
+// Compact columnar binary layout (written by save_dataset for paths ending with BINARY_EXTENSION):
+//   magic, version (u32), value type (u32, BinaryPrecision), metadata line count (u32), lines (u32 length + chars),
+//   n_wavelengths (u64), n_sample_points (u64), theta and phi rows (f32), luminance and intensity rows (value type)
+void load_binary_dataset(
+    const char* begin,
+    const char* end,
+    RawMeasurement& raw_measurement,
+    Matrix2Xf& V2D,
+    VectorXf& wavelengths,
+    Metadata& metadata
+)
+{
+    uint32_t precision;
+    const char* p = read_binary_metadata(begin, end, metadata, precision);
+    auto read = [&p, end](void* data, size_t size) {
+        if (size_t(end - p) < size)
+            throw std::runtime_error("Invalid binary data format (truncated file)");
+        memcpy(data, p, size);
+        p += size;
+    };
+    auto read_u64 = [&read]() { uint64_t value; read(&value, sizeof(value)); return value; };
+
+    const size_t value_size = precision == uint32_t(BinaryPrecision::FLOAT16) ? sizeof(uint16_t) : sizeof(float);
+    metadata.init_infos(wavelengths);
+
+    uint64_t n_wavelengths = read_u64();
+    uint64_t n_points = read_u64();
+    if (n_points != 0 && 2 * sizeof(float) + (n_wavelengths + 1) * value_size > size_t(end - p) / n_points)
+        throw std::runtime_error("Invalid binary data format (truncated file)");
+    raw_measurement.resize(n_wavelengths, n_points);
+    read(raw_measurement.data(), 2 * n_points * sizeof(float));
+    if (value_size == sizeof(float))
+    {
+        read(raw_measurement.data() + 2 * n_points, (n_wavelengths + 1) * n_points * sizeof(float));
+    }
+    else
+    {
+        const uint16_t* values = reinterpret_cast<const uint16_t*>(p);
+        tbb::parallel_for(tbb::blocked_range<size_t>(2, n_wavelengths + 3, 1),
+            [&](const tbb::blocked_range<size_t>& range)
+            {
+                for (size_t r = range.begin(); r != range.end(); ++r)
+                {
+                    // the mapped data may not be aligned, convert through a small aligned buffer
+                    uint16_t buffer[GRAIN_SIZE];
+                    for (size_t i = 0; i < n_points; i += GRAIN_SIZE)
+                    {
+                        size_t count = std::min<size_t>(GRAIN_SIZE, n_points - i);
+                        memcpy(buffer, values + (r - 2) * n_points + i, count * sizeof(uint16_t));
+                        half_to_float(buffer, raw_measurement[r].data() + i, count);
+                    }
+                }
+            }
+        );
+    }
+
+    finalize_points(raw_measurement, V2D, metadata);
+}
+
+// format a value exactly like printf's "%lf " does
+inline char* format_value(char* out, char* out_end, float value)
+{
+#if defined(__cpp_lib_to_chars)
+    out = std::to_chars(out, out_end, double(value), std::chars_format::fixed, 6).ptr;
+    *out++ = ' ';
+    return out;
+#else
+    return out + snprintf(out, out_end - out, "%lf ", value);
+#endif
+}
+
+void save_text_dataset(
+    FILE* dataset_file,
+    const RawMeasurement& raw_measurement
+)
+{
+    const size_t n_points = raw_measurement.n_sample_points();
+    const size_t n_rows = raw_measurement.n_wavelengths() + 3;
+    const size_t n_blocks = (n_points + SAVING_BLOCK_SIZE - 1) / SAVING_BLOCK_SIZE;
+
+    // format a wave of point blocks in parallel, then write them in order
+    vector<vector<char>> buffers(std::min<size_t>(n_blocks, SAVING_WAVE_SIZE));
+    for (size_t wave_begin = 0; wave_begin < n_blocks; wave_begin += SAVING_WAVE_SIZE)
+    {
+        size_t wave_end = std::min(n_blocks, wave_begin + SAVING_WAVE_SIZE);
+        tbb::parallel_for(tbb::blocked_range<size_t>(wave_begin, wave_end, 1),
+            [&](const tbb::blocked_range<size_t>& range)
+            {
+                for (size_t b = range.begin(); b != range.end(); ++b)
+                {
+                    vector<char>& buffer = buffers[b - wave_begin];
+                    buffer.clear();
+
+                    char value_buffer[64];
+                    for (size_t i = b * SAVING_BLOCK_SIZE; i < std::min(n_points, (b + 1) * SAVING_BLOCK_SIZE); ++i)
+                    {
+                        for (size_t j = 0; j < n_rows; ++j)
+                        {
+                            // spectral files have no luminance column (it is derived from the intensities)
+                            if (j == 2 && n_rows > 3)
+                                continue;
+                            char* value_end = format_value(value_buffer, value_buffer + sizeof(value_buffer), raw_measurement(j, i));
+                            buffer.insert(buffer.end(), value_buffer, value_end);
+                        }
+                        buffer.push_back('\n');
+                    }
+                }
+            }
+        );
+
+        for (size_t b = wave_begin; b < wave_end; ++b)
+        {
+            const vector<char>& buffer = buffers[b - wave_begin];
+            if (fwrite(buffer.data(), 1, buffer.size(), dataset_file) != buffer.size())
+                throw std::runtime_error("Unable to write dataset");
+        }
+    }
+}
+
+void save_binary_dataset(
+    FILE* dataset_file,
+    const RawMeasurement& raw_measurement,
+    const Metadata& metadata,
+    BinaryPrecision precision
+)
+{
+    auto write = [dataset_file](const void* data, size_t size) {
+        if (size != 0 && fwrite(data, 1, size, dataset_file) != size)
+            throw std::runtime_error("Unable to write dataset");
+    };
+    auto write_u32 = [&write](uint32_t value) { write(&value, sizeof(value)); };
+    auto write_u64 = [&write](uint64_t value) { write(&value, sizeof(value)); };
+
+    write(BINARY_MAGIC, sizeof(BINARY_MAGIC));
+    write_u32(BINARY_VERSION);
+    write_u32(uint32_t(precision));
+
+    write_u32(static_cast<uint32_t>(metadata.raw_metadata().size()));
+    for (const auto& line : metadata.raw_metadata())
+    {
+        write_u32(static_cast<uint32_t>(line.size()));
+        write(line.data(), line.size());
+    }
+
+    const size_t n_points = raw_measurement.n_sample_points();
+    write_u64(raw_measurement.n_wavelengths());
+    write_u64(n_points);
+
+    // angles are always kept in single precision (half precision steps are 0.125 degree between 128 and 256
+    // and 0.25 degree above, too coarse for the angular resolution of the measurements)
+    write(raw_measurement.data(), 2 * n_points * sizeof(float));
+    if (precision == BinaryPrecision::FLOAT32)
+    {
+        write(raw_measurement.luminance().data(), (raw_measurement.n_wavelengths() + 1) * n_points * sizeof(float));
+    }
+    else
+    {
+        vector<uint16_t> row(n_points);
+        for (size_t r = 2; r < raw_measurement.n_wavelengths() + 3; ++r)
+        {
+            float_to_half(raw_measurement[r].data(), row.data(), n_points);
+            write(row.data(), row.size() * sizeof(uint16_t));
+        }
     }
 }
 
 void save_dataset(
     const string& path,
     const RawMeasurement& raw_measurement,
-    const Metadata& metadata
+    const Metadata& metadata,
+    BinaryPrecision precision
 )
 {
-    cout << std::setw(50) << std::left << "Saving dataset .. ";
+    if (s_verbose)
+        cout << std::setw(50) << std::left << "Saving dataset .. ";
     Timer<> timer;
-    
+
+    bool binary = ends_with(path, BINARY_EXTENSION);
+
     // try open file
-    FILE* dataset_file = fopen(path.c_str(), "w");
+    FILE* dataset_file = fopen(path.c_str(), binary ? "wb" : "w");
     if (!dataset_file)
         throw std::runtime_error("Unable to open file \"" + path + "\"");
 
-    // save metadata
-    for(const auto& line: metadata.raw_metadata())
-        fprintf(dataset_file, "%s\n", line.c_str());
-
-    //!feof(dataset_file) && !ferror(dataset_file))
-    for (size_t i = 0; i < raw_measurement.n_sample_points(); ++i)
-    {
-        for (size_t j = 0; j < raw_measurement.n_wavelengths() + 3; ++j)
+    try {
+        if (binary)
         {
-            fprintf(dataset_file, "%lf ", raw_measurement[j][i]);
+            save_binary_dataset(dataset_file, raw_measurement, metadata, precision);
         }
-        fprintf(dataset_file, "\n");
+        else
+        {
+            // save metadata
+            for(const auto& line: metadata.raw_metadata())
+                fprintf(dataset_file, "%s\n", line.c_str());
+
+            save_text_dataset(dataset_file, raw_measurement);
+        }
+    } catch (...) {
+        fclose(dataset_file);
+        throw;
     }
     fclose(dataset_file);
-    
-    cout << "done. (took " <<  time_string(timer.value()) << ")" << endl;
+
+    if (s_verbose)
+        cout << "done. (took " <<  time_string(timer.value()) << ")" << endl;
 }
 
 TEKARI_NAMESPACE_END
@@ -212,7 +212,11 @@ void Dataset::recompute_data()
 {
     triangulate_data(m_f, m_v2d);
     compute_path_segments(m_path_segments, m_v2d);
+    reset_buffers();
+}
 
+void Dataset::reset_buffers()
+{
     size_t n_intensities = m_raw_measurement.n_wavelengths() + 1;     // account for luminance
     size_t n_sample_points = m_raw_measurement.n_sample_points();
     m_h[0].resize(n_intensities, n_sample_points);
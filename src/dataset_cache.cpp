@@ -0,0 +1,384 @@
+#include <tekari/dataset_cache.h>
+
+#include <filesystem>
+#include <thread>
+#include <tekari/mapped_file.h>
+
+TEKARI_NAMESPACE_BEGIN
+
+namespace fs = std::filesystem;
+
+#define CACHE_MAGIC "tekari_cache"          // 12 bytes, the terminating null character isn't stored
+#define CACHE_VERSION 1u
+#define CACHE_EXTENSION ".tkc"
+#define ALBEDO_CACHE_MAGIC "tekari_albed"   // 12 bytes, the terminating null character isn't stored
+#define ALBEDO_CACHE_VERSION 1u
+#define ALBEDO_CACHE_EXTENSION ".tka"
+#define CACHE_MAGIC_SIZE 12
+
+static DatasetCacheMode s_cache_mode = DatasetCacheMode::DISABLED;
+
+void set_dataset_cache_mode(DatasetCacheMode mode) { s_cache_mode = mode; }
+DatasetCacheMode dataset_cache_mode() { return s_cache_mode; }
+
+// Identifies the exact version of a measurement file a cache was built from
+struct CacheKey
+{
+    string path;
+    uint64_t size;
+    int64_t mtime;
+
+    bool operator==(const CacheKey& other) const
+    {
+        return path == other.path && size == other.size && mtime == other.mtime;
+    }
+};
+
+static CacheKey make_cache_key(const string& file_name)
+{
+    fs::path path = fs::canonical(fs::u8path(file_name));
+    return CacheKey{
+        path.u8string(),
+        static_cast<uint64_t>(fs::file_size(path)),
+        static_cast<int64_t>(fs::last_write_time(path).time_since_epoch().count())
+    };
+}
+
+static fs::path user_cache_directory()
+{
+#if defined(_WIN32)
+    const char* base = getenv("LOCALAPPDATA");
+    return base ? fs::u8path(base) / "tekari" / "cache" : fs::temp_directory_path() / "tekari";
+#elif defined(__APPLE__)
+    const char* home = getenv("HOME");
+    return home ? fs::u8path(home) / "Library" / "Caches" / "tekari" : fs::temp_directory_path() / "tekari";
+#else
+    const char* base = getenv("XDG_CACHE_HOME");
+    if (base && *base)
+        return fs::u8path(base) / "tekari";
+    const char* home = getenv("HOME");
+    return home ? fs::u8path(home) / ".cache" / "tekari" : fs::temp_directory_path() / "tekari";
+#endif
+}
+
+static fs::path cache_path(const CacheKey& key, const char* extension = CACHE_EXTENSION)
+{
+    if (s_cache_mode == DatasetCacheMode::NEXT_TO_FILE)
+        return fs::u8path(key.path + extension);
+
+    // name the cache after a (FNV-1a) hash of the canonical path of the measurement
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : key.path)
+    {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 1099511628211ull;
+    }
+    std::ostringstream name;
+    name << std::hex << std::setw(16) << std::setfill('0') << hash << extension;
+    return user_cache_directory() / name.str();
+}
+
+// Sequential reader over the mapped cache file, throws if the file is truncated
+class CacheReader
+{
+public:
+    CacheReader(const MappedFile& file) : m_ptr(file.begin()), m_end(file.end()) {}
+
+    size_t remaining() const { return m_end - m_ptr; }
+    // throws if fewer than count elements of element_size bytes are left (sizes read from
+    // a corrupted file must be checked before anything is allocated for them)
+    void expect(size_t count, size_t element_size)
+    {
+        if (count > remaining() / element_size)
+            throw std::runtime_error("truncated cache file");
+    }
+    void read(void* data, size_t size)
+    {
+        if (remaining() < size)
+            throw std::runtime_error("truncated cache file");
+        memcpy(data, m_ptr, size);
+        m_ptr += size;
+    }
+    template <typename T> T read()
+    {
+        T value;
+        read(&value, sizeof(T));
+        return value;
+    }
+    string read_string()
+    {
+        uint32_t size = read<uint32_t>();
+        expect(size, 1);
+        string value(size, '\0');
+        read(&value[0], value.size());
+        return value;
+    }
+
+private:
+    const char* m_ptr;
+    const char* m_end;
+};
+
+// Sequential writer into a cache file, throws if a write fails
+class CacheWriter
+{
+public:
+    CacheWriter(FILE* file) : m_file(file) {}
+
+    void write(const void* data, size_t size)
+    {
+        if (size != 0 && fwrite(data, 1, size, m_file) != size)
+            throw std::runtime_error("unable to write cache file");
+    }
+    template <typename T> void write(T value) { write(&value, sizeof(T)); }
+    void write_string(const string& value)
+    {
+        write(static_cast<uint32_t>(value.size()));
+        write(value.data(), value.size());
+    }
+
+private:
+    FILE* m_file;
+};
+
+// Both caches start with their magic, their version and the key of the measurement file
+static CacheKey read_cache_header(CacheReader& reader, const char* magic, uint32_t version)
+{
+    char file_magic[CACHE_MAGIC_SIZE];
+    reader.read(file_magic, sizeof(file_magic));
+    if (memcmp(file_magic, magic, sizeof(file_magic)) != 0 || reader.read<uint32_t>() != version)
+        throw std::runtime_error("invalid cache file");
+
+    CacheKey key;
+    key.path = reader.read_string();
+    key.size = reader.read<uint64_t>();
+    key.mtime = reader.read<int64_t>();
+    return key;
+}
+
+static void write_cache_header(CacheWriter& writer, const char* magic, uint32_t version, const CacheKey& key)
+{
+    writer.write(magic, CACHE_MAGIC_SIZE);
+    writer.write(version);
+    writer.write_string(key.path);
+    writer.write(key.size);
+    writer.write(key.mtime);
+}
+
+// Writes a cache file to a temporary file first, renamed once complete, so that
+// a concurrent reader never sees a partial cache
+static void write_cache_file(const fs::path& path, const function<void(CacheWriter&)>& write_content)
+{
+    fs::create_directories(path.parent_path());
+    fs::path temp_path = path;
+    temp_path += ".tmp" + to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+
+    FILE* file = fopen(temp_path.u8string().c_str(), "wb");
+    if (!file)
+        throw std::runtime_error("unable to open \"" + temp_path.u8string() + "\"");
+
+    try {
+        CacheWriter writer(file);
+        write_content(writer);
+    } catch (...) {
+        fclose(file);
+        fs::remove(temp_path);
+        throw;
+    }
+    fclose(file);
+    fs::rename(temp_path, path);
+}
+
+bool load_dataset_cache(
+    const string& file_name,
+    RawMeasurement& raw_measurement,
+    Matrix2Xf& V2D,
+    Matrix3Xi& F,
+    VectorXu& path_segments,
+    VectorXf& wavelengths,
+    Metadata& metadata
+)
+{
+    if (s_cache_mode == DatasetCacheMode::DISABLED)
+        return false;
+
+    cout << std::setw(50) << std::left << "Loading dataset from cache .. ";
+    Timer<> timer;
+
+    try {
+        CacheKey key = make_cache_key(file_name);
+        fs::path path = cache_path(key);
+        if (!fs::exists(path))
+        {
+            cout << "not found." << endl;
+            return false;
+        }
+
+        MappedFile file(path.u8string());
+        CacheReader reader(file);
+        if (!(read_cache_header(reader, CACHE_MAGIC, CACHE_VERSION) == key))
+        {
+            cout << "outdated." << endl;
+            return false;
+        }
+
+        // read everything in temporaries first, to leave the outputs untouched on failure
+        Metadata cached_metadata;
+        uint32_t n_metadata_lines = reader.read<uint32_t>();
+        for (uint32_t i = 0; i < n_metadata_lines; ++i)
+            cached_metadata.add_line(reader.read_string());
+        VectorXf cached_wavelengths;
+        cached_metadata.init_infos(cached_wavelengths);
+
+        size_t n_wavelengths = reader.read<uint64_t>();
+        size_t n_sample_points = reader.read<uint64_t>();
+        // each point has its angles, luminance and intensities, and its 2D coordinates
+        reader.expect(n_wavelengths, sizeof(float));
+        reader.expect(n_sample_points, (n_wavelengths + 3) * sizeof(float) + sizeof(Vector2f));
+        RawMeasurement cached_raw_measurement(n_wavelengths, n_sample_points);
+        reader.read(cached_raw_measurement.data(), cached_raw_measurement.size() * sizeof(float));
+
+        Matrix2Xf cached_V2D(n_sample_points);
+        reader.read(cached_V2D.data(), n_sample_points * sizeof(Vector2f));
+
+        size_t n_faces = reader.read<uint64_t>();
+        reader.expect(n_faces, 3 * sizeof(int));
+        Matrix3Xi cached_F(n_faces, 3);
+        reader.read(cached_F.data(), cached_F.size() * sizeof(int));
+
+        size_t n_path_segments = reader.read<uint64_t>();
+        reader.expect(n_path_segments, sizeof(uint32_t));
+        VectorXu cached_path_segments(n_path_segments);
+        reader.read(cached_path_segments.data(), cached_path_segments.size() * sizeof(uint32_t));
+
+        cached_metadata.set_points_in_file(n_sample_points);
+
+        raw_measurement = std::move(cached_raw_measurement);
+        V2D = std::move(cached_V2D);
+        F = std::move(cached_F);
+        path_segments = std::move(cached_path_segments);
+        wavelengths = std::move(cached_wavelengths);
+        metadata = std::move(cached_metadata);
+    } catch (const std::exception& e) {
+        cout << "failed. (" << e.what() << ")" << endl;
+        return false;
+    }
+
+    cout << "done. (took " <<  time_string(timer.value()) << ")" << endl;
+    return true;
+}
+
+void save_dataset_cache(
+    const string& file_name,
+    const RawMeasurement& raw_measurement,
+    const Matrix2Xf& V2D,
+    const Matrix3Xi& F,
+    const VectorXu& path_segments,
+    const Metadata& metadata
+)
+{
+    if (s_cache_mode == DatasetCacheMode::DISABLED)
+        return;
+
+    cout << std::setw(50) << std::left << "Saving dataset cache .. ";
+    Timer<> timer;
+
+    try {
+        CacheKey key = make_cache_key(file_name);
+        write_cache_file(cache_path(key), [&](CacheWriter& writer) {
+            write_cache_header(writer, CACHE_MAGIC, CACHE_VERSION, key);
+
+            writer.write(static_cast<uint32_t>(metadata.raw_metadata().size()));
+            for (const auto& line : metadata.raw_metadata())
+                writer.write_string(line);
+
+            writer.write(static_cast<uint64_t>(raw_measurement.n_wavelengths()));
+            writer.write(static_cast<uint64_t>(raw_measurement.n_sample_points()));
+            writer.write(raw_measurement.data(), raw_measurement.size() * sizeof(float));
+            writer.write(V2D.data(), V2D.size() * sizeof(Vector2f));
+
+            writer.write(static_cast<uint64_t>(F.n_rows()));
+            writer.write(F.data(), F.size() * sizeof(int));
+
+            writer.write(static_cast<uint64_t>(path_segments.size()));
+            writer.write(path_segments.data(), path_segments.size() * sizeof(uint32_t));
+        });
+    } catch (const std::exception& e) {
+        cout << "failed. (" << e.what() << ")" << endl;
+        return;
+    }
+
+    cout << "done. (took " <<  time_string(timer.value()) << ")" << endl;
+}
+
+bool load_albedo_map_cache(const string& file_name, AlbedoMap& map)
+{
+    cout << std::setw(50) << std::left << "Loading albedo map from cache .. ";
+    Timer<> timer;
+
+    try {
+        CacheKey key = make_cache_key(file_name);
+        fs::path path = cache_path(key, ALBEDO_CACHE_EXTENSION);
+        if (!fs::exists(path))
+        {
+            cout << "not found." << endl;
+            return false;
+        }
+
+        MappedFile file(path.u8string());
+        CacheReader reader(file);
+        CacheKey cached_key = read_cache_header(reader, ALBEDO_CACHE_MAGIC, ALBEDO_CACHE_VERSION);
+        size_t n_theta = reader.read<uint64_t>();
+        size_t n_phi = reader.read<uint64_t>();
+        size_t n_samples = reader.read<uint64_t>();
+        if (!(cached_key == key) || n_theta != map.n_theta || n_phi != map.n_phi || n_samples != map.n_samples)
+        {
+            cout << "outdated." << endl;
+            return false;
+        }
+
+        size_t n_wavelengths = reader.read<uint64_t>();
+        reader.expect(n_theta * n_phi, sizeof(float));
+        reader.expect(n_wavelengths, n_theta * n_phi * sizeof(float));
+        vector<float> luminance(n_theta * n_phi);
+        vector<float> spectra(n_wavelengths * n_theta * n_phi);
+        reader.read(luminance.data(), luminance.size() * sizeof(float));
+        reader.read(spectra.data(), spectra.size() * sizeof(float));
+
+        map.luminance = std::move(luminance);
+        map.spectra = std::move(spectra);
+    } catch (const std::exception& e) {
+        cout << "failed. (" << e.what() << ")" << endl;
+        return false;
+    }
+
+    cout << "done. (took " <<  time_string(timer.value()) << ")" << endl;
+    return true;
+}
+
+void save_albedo_map_cache(const string& file_name, const AlbedoMap& map)
+{
+    cout << std::setw(50) << std::left << "Saving albedo map cache .. ";
+    Timer<> timer;
+
+    try {
+        CacheKey key = make_cache_key(file_name);
+        write_cache_file(cache_path(key, ALBEDO_CACHE_EXTENSION), [&](CacheWriter& writer) {
+            write_cache_header(writer, ALBEDO_CACHE_MAGIC, ALBEDO_CACHE_VERSION, key);
+
+            writer.write(static_cast<uint64_t>(map.n_theta));
+            writer.write(static_cast<uint64_t>(map.n_phi));
+            writer.write(static_cast<uint64_t>(map.n_samples));
+            writer.write(static_cast<uint64_t>(map.spectra.size() / std::max<size_t>(map.luminance.size(), 1)));
+            writer.write(map.luminance.data(), map.luminance.size() * sizeof(float));
+            writer.write(map.spectra.data(), map.spectra.size() * sizeof(float));
+        });
+    } catch (const std::exception& e) {
+        cout << "failed. (" << e.what() << ")" << endl;
+        return;
+    }
+
+    cout << "done. (took " <<  time_string(timer.value()) << ")" << endl;
+}
+
+TEKARI_NAMESPACE_END
@@ -1,4 +1,6 @@
 #include <tekari/bsdf_application.h>
+#include <tekari/dataset_cache.h>
+#include <tekari/bsdf_dataset.h>
 
 #if defined(EMSCRIPTEN)
 #  include <emscripten.h>
@@ -14,6 +16,7 @@ int main(int argc, char** argv) {
     using namespace nanogui;
 
     vector<string> dataset_paths;
+    string catalog_index, catalog_query;
     bool log_mode = false,
          help = false;
 
@@ -22,6 +25,31 @@ int main(int argc, char** argv) {
             log_mode = true;
             continue;
         }
+        if (strcmp(argv[i], "-c") == 0) {
+            set_dataset_cache_mode(DatasetCacheMode::USER_DIRECTORY);
+            continue;
+        }
+        if (strcmp(argv[i], "-C") == 0) {
+            set_dataset_cache_mode(DatasetCacheMode::NEXT_TO_FILE);
+            continue;
+        }
+        if (strcmp(argv[i], "-H") == 0) {
+            set_bsdf_half_precision(true);
+            continue;
+        }
+        if (strcmp(argv[i], "-S") == 0) {
+            set_bsdf_background_spectra(true);
+            continue;
+        }
+        if (strcmp(argv[i], "-A") == 0) {
+            set_bsdf_adaptive_sampling(true);
+            continue;
+        }
+        if ((strcmp(argv[i], "-i") == 0 || strcmp(argv[i], "-q") == 0) && i + 1 < argc) {
+            (argv[i][1] == 'i' ? catalog_index : catalog_query) = argv[i + 1];
+            ++i;
+            continue;
+        }
         if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
             help = true;
             continue;
@@ -32,9 +60,17 @@ int main(int argc, char** argv) {
     }
 
     if (help) {
-        std::cout << "Usage: tekari [-l] <file1.bsdf> <file2.bsdf> ..." << std::endl;
+        std::cout << "Usage: tekari [-l] [-c|-C] [-H] [-S] [-A] [-i <index> [-q <query>]] <file1.bsdf> <file2.bsdf> ..." << std::endl;
         std::cout << "Options:" << std::endl;
         std::cout << "   -l      Directly open in logarithmic view." << std::endl;
+        std::cout << "   -c      Cache parsed measurements in the user cache directory." << std::endl;
+        std::cout << "   -C      Cache parsed measurements next to the measurement files." << std::endl;
+        std::cout << "   -H      Keep the spectra of .bsdf files in half precision (halves their memory use)." << std::endl;
+        std::cout << "   -S      Sample all the wavelengths of .bsdf files in the background when changing the incident angle." << std::endl;
+        std::cout << "   -A      Sample .bsdf files adaptively (denser where they vary the most, fewer points overall)." << std::endl;
+        std::cout << "   -i      Open the measurements of a catalog index (see tekari-convert -i)." << std::endl;
+        std::cout << "   -q      Only open the indexed measurements matching a query, e.g." << std::endl;
+        std::cout << "           \"sample=<name>,theta=<degrees>,phi=<degrees>,spectral|standard\"." << std::endl;
         return 0;
     }
 
@@ -105,6 +141,14 @@ int main(int argc, char** argv) {
             );
 #endif
 
+            if (!catalog_index.empty())
+            {
+                Catalog catalog;
+                if (!catalog.load(catalog_index))
+                    throw std::runtime_error("Unable to read the catalog index \"" + catalog_index + "\"");
+                screen->open_files(catalog, parse_catalog_query(catalog_query));
+            }
+
             screen->set_visible(true);
             screen->perform_layout();
             mainloop(-1);
@@ -0,0 +1,124 @@
+#include <tekari/mapped_file.h>
+
+#if !defined(_WIN32) && !defined(EMSCRIPTEN)
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
+TEKARI_NAMESPACE_BEGIN
+
+#if defined(_WIN32)
+
+MappedFile::MappedFile(const string& path)
+:   m_data(nullptr)
+,   m_size(0)
+,   m_file(INVALID_HANDLE_VALUE)
+,   m_mapping(NULL)
+{
+    m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                         OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (m_file == INVALID_HANDLE_VALUE)
+        throw std::runtime_error("Unable to open file \"" + path + "\"");
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(m_file, &file_size))
+    {
+        CloseHandle(m_file);
+        throw std::runtime_error("Unable to query size of file \"" + path + "\"");
+    }
+    m_size = static_cast<size_t>(file_size.QuadPart);
+    if (m_size == 0)
+        return;
+
+    m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (m_mapping != NULL)
+        m_data = static_cast<const char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+    if (!m_data)
+    {
+        if (m_mapping != NULL)
+            CloseHandle(m_mapping);
+        CloseHandle(m_file);
+        throw std::runtime_error("Unable to map file \"" + path + "\"");
+    }
+}
+
+MappedFile::~MappedFile()
+{
+    if (m_data)
+        UnmapViewOfFile(m_data);
+    if (m_mapping != NULL)
+        CloseHandle(m_mapping);
+    if (m_file != INVALID_HANDLE_VALUE)
+        CloseHandle(m_file);
+}
+
+#elif defined(EMSCRIPTEN)
+
+MappedFile::MappedFile(const string& path)
+:   m_data(nullptr)
+,   m_size(0)
+{
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file)
+        throw std::runtime_error("Unable to open file \"" + path + "\"");
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+
+    m_buffer.resize(size > 0 ? static_cast<size_t>(size) : 0);
+    size_t read = fread(m_buffer.data(), 1, m_buffer.size(), file);
+    fclose(file);
+    if (read != m_buffer.size())
+        throw std::runtime_error("Unable to read file \"" + path + "\"");
+
+    m_data = m_buffer.data();
+    m_size = m_buffer.size();
+}
+
+MappedFile::~MappedFile() {}
+
+#else
+
+MappedFile::MappedFile(const string& path)
+:   m_data(nullptr)
+,   m_size(0)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+        throw std::runtime_error("Unable to open file \"" + path + "\"");
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == -1)
+    {
+        close(fd);
+        throw std::runtime_error("Unable to query size of file \"" + path + "\"");
+    }
+    m_size = static_cast<size_t>(file_stat.st_size);
+    if (m_size == 0)
+    {
+        close(fd);
+        return;
+    }
+
+    void* data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);              // the mapping keeps its own reference to the file
+    if (data == MAP_FAILED)
+        throw std::runtime_error("Unable to map file \"" + path + "\"");
+
+    // the loaders read the file front to back
+    madvise(data, m_size, MADV_SEQUENTIAL);
+    m_data = static_cast<const char*>(data);
+}
+
+MappedFile::~MappedFile()
+{
+    if (m_data)
+        munmap(const_cast<char*>(m_data), m_size);
+}
+
+#endif
+
+TEKARI_NAMESPACE_END
@@ -1,5 +1,6 @@
 #include <tekari/selections.h>
 #include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
 
 TEKARI_NAMESPACE_BEGIN
 
@@ -59,13 +60,23 @@ void select_closest_point(
     cout << std::setw(50) << std::left << "Selecting closest point .. ";
     Timer<> timer;
 
-    size_t n_threads = V2D.size() / GRAIN_SIZE + ((V2D.size() % GRAIN_SIZE) > 0);
-    vector<float> smallest_distances(n_threads, MAX_SELECT_DISTANCE* MAX_SELECT_DISTANCE);
-    vector<int> closest_point_indices(n_threads, -1);
+    // closest projected point within the selection distance (the lowest index on ties, like a sequential scan)
+    struct ClosestPoint
+    {
+        float distance_sqr;
+        int index;
 
-    tbb::parallel_for(tbb::blocked_range<uint32_t>(0, (uint32_t)V2D.size(), GRAIN_SIZE),
-        [&](const tbb::blocked_range<uint32_t>& range) {
-        uint32_t thread_id = range.begin() / GRAIN_SIZE;
+        bool operator<(const ClosestPoint& other) const
+        {
+            return distance_sqr < other.distance_sqr ||
+                   (distance_sqr == other.distance_sqr && uint32_t(index) < uint32_t(other.index));
+        }
+    };
+
+    ClosestPoint closest = tbb::parallel_reduce(
+        tbb::blocked_range<uint32_t>(0, (uint32_t)V2D.size(), GRAIN_SIZE),
+        ClosestPoint{ MAX_SELECT_DISTANCE * MAX_SELECT_DISTANCE, -1 },
+        [&](const tbb::blocked_range<uint32_t>& range, ClosestPoint closest) {
         for (uint32_t i = range.begin(); i < range.end(); ++i)
         {
             Vector3f point = get_3d_point(V2D, H, i);
@@ -73,27 +84,16 @@ void select_closest_point(
 
             float dist_sqr = enoki::squared_norm(Vector2f{ proj_point[0] - mouse_pos[0], proj_point[1] - mouse_pos[1] });
 
-            if (smallest_distances[thread_id] > dist_sqr)
-            {
-                closest_point_indices[thread_id]   = i;
-                smallest_distances[thread_id]     = dist_sqr;
-            }
+            if (closest.distance_sqr > dist_sqr)
+                closest = ClosestPoint{ dist_sqr, (int)i };
 
             selected_points[i] = NOT_SELECTED_FLAG;
         }
-    });
+        return closest;
+    },
+        [](const ClosestPoint& a, const ClosestPoint& b) { return b < a ? b : a; });
 
-    float smallest_distance = MAX_SELECT_DISTANCE* MAX_SELECT_DISTANCE;
-    int closest_point_index = -1;
-
-    for (size_t i = 0; i < smallest_distances.size(); i++)
-    {
-        if (smallest_distance > smallest_distances[i])
-        {
-            closest_point_index = closest_point_indices[i];
-            smallest_distance = smallest_distances[i];
-        }
-    }
+    int closest_point_index = closest.index;
 
     if (closest_point_index != -1)
     {
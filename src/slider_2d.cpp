@@ -6,10 +6,21 @@ Slider2D::Slider2D(Widget *parent)
 : Widget(parent)
 , m_value(0.0f, 0.0f)
 , m_range(Vector2i(0.0f, 0.0f), Vector2i(1.0f, 1.0f))
+, m_overlay_n_x(0)
+, m_overlay_n_y(0)
 {
     m_highlight_color = Color(255, 80, 80, 70);
 }
 
+void Slider2D::set_overlay(const vector<float>& values, size_t n_x, size_t n_y)
+{
+    if (values.size() != n_x * n_y)
+        throw std::runtime_error("Slider2D: overlay size doesn't match its resolution");
+    m_overlay = values;
+    m_overlay_n_x = n_x;
+    m_overlay_n_y = n_y;
+}
+
 Vector2i Slider2D::preferred_size(NVGcontext *ctx) const
 {
     return Vector2i(70, 70);
@@ -68,6 +79,26 @@ void Slider2D::draw(NVGcontext* ctx)
     nvgFillPaint(ctx, bg);
     nvgFill(ctx);
 
+    // overlay cells (black -> red -> yellow -> white)
+    if (!m_overlay.empty())
+    {
+        Vector2f cell = size / Vector2f(float(m_overlay_n_x), float(m_overlay_n_y));
+        for (size_t x = 0; x < m_overlay_n_x; ++x)
+        {
+            for (size_t y = 0; y < m_overlay_n_y; ++y)
+            {
+                float v = enoki::clamp(m_overlay[x * m_overlay_n_y + y], 0.0f, 1.0f);
+                nvgBeginPath(ctx);
+                nvgRect(ctx, start.x() + x * cell.x(), start.y() + y * cell.y(), cell.x(), cell.y());
+                nvgFillColor(ctx, Color(enoki::clamp(3.0f * v, 0.0f, 1.0f),
+                                        enoki::clamp(3.0f * v - 1.0f, 0.0f, 1.0f),
+                                        enoki::clamp(3.0f * v - 2.0f, 0.0f, 1.0f),
+                                        m_enabled ? 0.6f : 0.3f));
+                nvgFill(ctx);
+            }
+        }
+    }
+
     Vector2f div = size / 10.0f;
     nvgBeginPath(ctx);
     for (int i = 0; i <= 10; ++i)
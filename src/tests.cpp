@@ -5,14 +5,24 @@
 #include <iostream>
 #include <string>
 #include <tekari/matrix_xx.h>
+#include <tekari/data_io.h>
+#include <tekari/float16.h>
+#include <cfloat>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <sstream>
 #define POWITACQ_IMPLEMENTATION
 #include <tekari/powitacq.h>
 #include <tekari/cie1931.h>
 
 using namespace tekari;
 
+static int s_failures = 0;
+
 #define ASSERT(cond, fmt, ...) \
     if (!(cond)) { \
+        ++s_failures; \
         fprintf(stderr, "[Error:%s:%d] ", __func__, __LINE__); \
         fprintf(stderr, fmt, __VA_ARGS__); \
     }
@@ -65,6 +75,27 @@ void test_clear()
     check_dims(0, 0, m);
 }
 
+template<typename T>
+void test_conservative_resize(size_t rows, size_t cols)
+{
+    MatrixXX<T> m(rows, cols);
+    for(size_t i = 0; i < m.n_rows(); ++i)
+        for(size_t j = 0; j < m.n_cols(); ++j)
+            m[i][j] = T(i * cols + j);
+
+    m.conservative_resize(rows, cols / 2);
+    check_dims(rows, cols / 2, m);
+    for(size_t i = 0; i < m.n_rows(); ++i)
+        for(size_t j = 0; j < m.n_cols(); ++j)
+            ASSERT(m[i][j] == T(i * cols + j), "%s\n", "wrong value after shrinking");
+
+    m.conservative_resize(rows + 1, cols * 2);
+    check_dims(rows + 1, cols * 2, m);
+    for(size_t i = 0; i < rows; ++i)
+        for(size_t j = 0; j < cols / 2; ++j)
+            ASSERT(m[i][j] == T(i * cols + j), "%s\n", "wrong value after growing");
+}
+
 void test_iterator()
 {
     MatrixXX<int> m(6, 10);
@@ -82,12 +113,277 @@ void test_iterator()
     cout << m << endl;
 }
 
+static string read_file(const string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    std::ostringstream content;
+    content << file.rdbuf();
+    return content.str();
+}
+
+// Saved text datasets must stay exactly what the original fprintf("%lf ") writer produced
+void test_text_format()
+{
+    // magnitudes from denormals to FLT_MAX, rounding boundaries of the 6 decimals, and random bit patterns
+    vector<float> values = { 0.0f, -0.0f, 5e-7f, -5e-7f, 1.5e-6f, 2.5e-6f, 1e-9f, -1e-9f, 0.1f, 0.5f, 123456.789f,
+                             FLT_MIN, -FLT_MIN, FLT_MAX, -FLT_MAX, std::numeric_limits<float>::denorm_min() };
+    for (int e = -12; e <= 38; ++e)
+        for (float m : { 1.0f, 1.25f, 3.14159265f, 9.9999995f })
+        {
+            values.push_back(m * std::pow(10.0f, float(e)));
+            values.push_back(-m * std::pow(10.0f, float(e)));
+        }
+    std::mt19937 rng(7);
+    while (values.size() % 3 != 0 || values.size() < 30000)
+    {
+        uint32_t bits = rng();
+        float value;
+        memcpy(&value, &bits, sizeof(float));
+        if (std::isfinite(value))
+            values.push_back(value);
+    }
+
+    // a standard (3 columns) measurement holding the values
+    size_t n_points = values.size() / 3;
+    RawMeasurement raw_measurement(0, n_points);
+    for (size_t i = 0; i < n_points; ++i)
+        for (size_t j = 0; j < 3; ++j)
+            raw_measurement(j, i) = values[i * 3 + j];
+    Metadata metadata;
+    metadata.add_line("#datapoints_in_file " + std::to_string(n_points));
+
+    string expected;
+    char buffer[64];
+    for (const auto& line : metadata.raw_metadata())
+        expected += line + "\n";
+    for (size_t i = 0; i < n_points; ++i)
+    {
+        for (size_t j = 0; j < 3; ++j)
+        {
+            snprintf(buffer, sizeof(buffer), "%lf ", raw_measurement(j, i));
+            expected += buffer;
+        }
+        expected += "\n";
+    }
+
+    string path = (std::filesystem::temp_directory_path() / "tekari_tests_format.txt").string();
+    save_dataset(path, raw_measurement, metadata);
+    string saved = read_file(path);
+    std::filesystem::remove(path);
+
+    ASSERT(saved == expected, "%s\n", "saved text differs from the fprintf output");
+}
+
+// Binary datasets are read back exactly (or to half precision for the intensities of FLOAT16 files)
+void test_binary_round_trip(BinaryPrecision precision)
+{
+    const size_t n_wavelengths = 3, n_points = 5000;
+
+    Metadata metadata;
+    metadata.add_line("#spectral data generated by tekari tests");
+    metadata.add_line("#number of datapoints per loop in file: " + std::to_string(n_wavelengths));
+    metadata.add_line("#lambda= 400 550 700");
+    metadata.add_line("#intheta 30");
+    metadata.add_line("#inphi 45");
+
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<float> intensity(1e-3f, 1e3f);
+    RawMeasurement raw_measurement(n_wavelengths, n_points);
+    for (size_t i = 0; i < n_points; ++i)
+    {
+        // distinct coordinates, so that no point is removed as a duplicate
+        raw_measurement.set_theta(i, 90.0f * i / n_points);
+        raw_measurement.set_phi(i, 360.0f * ((i * 7919) % n_points) / n_points);
+        for (size_t w = 0; w < n_wavelengths; ++w)
+            raw_measurement(w + 3, i) = intensity(rng);
+        raw_measurement.set_luminance(i, raw_measurement(3, i));
+    }
+
+    string path = (std::filesystem::temp_directory_path() / "tekari_tests_round_trip.tkb").string();
+    save_dataset(path, raw_measurement, metadata, precision);
+
+    RawMeasurement loaded;
+    Matrix2Xf v2d;
+    VectorXf wavelengths;
+    Metadata loaded_metadata;
+    load_dataset(path, loaded, v2d, wavelengths, loaded_metadata);
+    std::filesystem::remove(path);
+
+    ASSERT(loaded_metadata.raw_metadata() == metadata.raw_metadata(), "%s\n", "metadata differs");
+    ASSERT(wavelengths.size() == n_wavelengths && wavelengths[1] == 550.0f, "%s\n", "wrong wavelengths");
+    ASSERT(loaded.n_wavelengths() == n_wavelengths, "got %zu wavelengths\n", loaded.n_wavelengths());
+    ASSERT(loaded.n_sample_points() == n_points, "got %zu points\n", loaded.n_sample_points());
+    ASSERT(v2d.size() == n_points, "got %zu 2d points\n", v2d.size());
+    if (loaded.n_wavelengths() != n_wavelengths || loaded.n_sample_points() != n_points)
+        return;
+
+    // angles are always kept in single precision
+    float max_error = 0.0f;
+    for (size_t i = 0; i < n_points; ++i)
+    {
+        ASSERT(loaded.theta()[i] == raw_measurement.theta()[i] && loaded.phi()[i] == raw_measurement.phi()[i],
+               "wrong angles for point %zu\n", i);
+        for (size_t r = 2; r < n_wavelengths + 3; ++r)
+            max_error = std::max(max_error, std::abs(loaded(r, i) - raw_measurement(r, i)) / raw_measurement(r, i));
+    }
+    float tolerance = precision == BinaryPrecision::FLOAT32 ? 0.0f : 1.0f / 2048;
+    ASSERT(max_error <= tolerance, "intensities off by %g (relative)\n", max_error);
+}
+
+static bool same_bits(float a, float b) { return memcmp(&a, &b, sizeof(float)) == 0; }
+
+// The binary datasets and the spectra of powitacq must round the same way to half precision,
+// with the scalar and batch conversions agreeing
+void test_half_conversions()
+{
+    size_t n_mismatches = 0;
+
+    // every half converts to the same float both ways, and back to itself (NaNs aside)
+    vector<uint16_t> halves(1 << 16);
+    vector<float> floats(halves.size());
+    for (size_t i = 0; i < halves.size(); ++i)
+        halves[i] = uint16_t(i);
+    half_to_float(halves.data(), floats.data(), halves.size());
+    for (size_t i = 0; i < halves.size(); ++i)
+    {
+        float value = half_to_float(halves[i]);
+        n_mismatches += !same_bits(value, floats[i]) || !same_bits(value, powitacq::to_float(powitacq::Half{ halves[i] }));
+        n_mismatches += value == value && float_to_half(value) != halves[i];
+    }
+    ASSERT(n_mismatches == 0, "%zu halves differ between the conversions\n", n_mismatches);
+
+    // the midpoints between consecutive finite halves round to the even one
+    n_mismatches = 0;
+    for (uint32_t i = 0; i < 0x7BFF; ++i)
+    {
+        float low = half_to_float(uint16_t(i)), high = half_to_float(uint16_t(i + 1));
+        float midpoint = low + (high - low) * 0.5f;
+        uint16_t even = uint16_t(i % 2 == 0 ? i : i + 1);
+        n_mismatches += float_to_half(midpoint) != even || float_to_half(-midpoint) != (even | 0x8000);
+    }
+    ASSERT(n_mismatches == 0, "%zu midpoints aren't rounded to even\n", n_mismatches);
+
+    // random floats (of any magnitude) convert the same way in batches, one by one and in powitacq
+    n_mismatches = 0;
+    std::mt19937 rng(16);
+    floats.resize(100003);       // not a multiple of the batch sizes
+    for (float& value : floats)
+    {
+        uint32_t bits = rng();
+        memcpy(&value, &bits, sizeof(float));
+    }
+    halves.resize(floats.size());
+    float_to_half(floats.data(), halves.data(), floats.size());
+    for (size_t i = 0; i < floats.size(); ++i)
+    {
+        uint16_t half = float_to_half(floats[i]);
+        n_mismatches += half != halves[i] || half != powitacq::from_float<powitacq::Half>(floats[i]).bits;
+    }
+    ASSERT(n_mismatches == 0, "%zu floats are rounded differently to half precision\n", n_mismatches);
+}
+
+// The packet variants of the warps must return exactly what the scalar ones return in each lane
+template <typename Value>
+void test_packet_warp(bool build_cdf)
+{
+    using Warp = powitacq::Marginal2D<2, Value>;
+    using Prepared1 = powitacq::PreparedParams<1>;
+    const size_t PacketSize = powitacq::PacketSize;
+
+    // a small table depending on two non-uniformly discretized parameters
+    const float params0[] = { 0.0f, 0.3f, 1.0f };
+    const float params1[] = { 400.0f, 420.0f, 500.0f, 510.0f, 700.0f };
+    const powitacq::Vector2u size(9, 7);
+    std::mt19937 rng(13);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    vector<float> values(3 * 5 * 9 * 7);
+    for (float& value : values)
+        value = 0.05f + uniform(rng);
+    vector<Value> data(values.size());
+    for (size_t i = 0; i < values.size(); ++i)
+        data[i] = powitacq::from_float<Value>(values[i]);
+    Warp warp(size, data.data(), { 3, 5 }, { params0, params1 }, build_cdf, build_cdf);
+    // discretizes the first parameter like the warp, to share it among the lanes
+    powitacq::Marginal2D<1> leading(size, values.data(), { 3 }, { params0 }, false, false);
+
+    // parameters inside intervals, on discretized values and at the ends of the ranges
+    auto param0 = [&]() { float u = uniform(rng); return u < 0.2f ? params0[rng() % 3] : u; };
+    auto param1 = [&]() { float u = uniform(rng); return u < 0.3f ? params1[rng() % 5] : 400.0f + 300.0f * u; };
+
+    size_t n_mismatches = 0;
+    for (int iteration = 0; iteration < 2000; ++iteration)
+    {
+        // the first lanes are filled, the others repeat the last one (like eval_spectrum's last packet)
+        size_t count = 1 + iteration % PacketSize;
+        float p0 = param0();
+        powitacq::Vector2fP pos, u;
+        powitacq::FloatP params[2];
+        for (size_t l = 0; l < PacketSize; ++l)
+        {
+            size_t lane = std::min(l, count - 1);
+            if (lane == l)
+            {
+                pos.x()[l] = uniform(rng); pos.y()[l] = uniform(rng);
+                u.x()[l] = uniform(rng); u.y()[l] = uniform(rng);
+                params[0][l] = p0;
+                params[1][l] = iteration % 3 == 0 ? params1[2] : param1();   // sometimes a single slice
+            }
+            else
+            {
+                pos.x()[l] = pos.x()[lane]; pos.y()[l] = pos.y()[lane];
+                u.x()[l] = u.x()[lane]; u.y()[l] = u.y()[lane];
+                params[0][l] = params[0][lane];
+                params[1][l] = params[1][lane];
+            }
+        }
+        Prepared1 prepared = leading.prepare(&p0);
+
+        powitacq::FloatP values_p = warp.eval(pos, params), values_prepared_p = warp.eval(pos, prepared, params);
+        std::pair<powitacq::Vector2fP, powitacq::FloatP> samples_p, inverted_p;
+        if (build_cdf)
+        {
+            samples_p = warp.sample(u, params);
+            inverted_p = warp.invert(u, prepared, params);
+        }
+
+        for (size_t l = 0; l < PacketSize; ++l)
+        {
+            float param[2] = { params[0][l], params[1][l] };
+            powitacq::Vector2f pos_l(pos.x()[l], pos.y()[l]), u_l(u.x()[l], u.y()[l]);
+
+            float value = warp.eval(pos_l, param);
+            bool same = same_bits(values_p[l], value) && same_bits(values_prepared_p[l], value);
+            if (build_cdf)
+            {
+                auto sample = warp.sample(u_l, param);
+                auto inverted = warp.invert(u_l, param);
+                same = same && same_bits(samples_p.first.x()[l], sample.first.x()) &&
+                       same_bits(samples_p.first.y()[l], sample.first.y()) &&
+                       same_bits(samples_p.second[l], sample.second) &&
+                       same_bits(inverted_p.first.x()[l], inverted.first.x()) &&
+                       same_bits(inverted_p.first.y()[l], inverted.first.y()) &&
+                       same_bits(inverted_p.second[l], inverted.second);
+            }
+            n_mismatches += !same;
+        }
+    }
+    ASSERT(n_mismatches == 0, "%zu lanes differ from the scalar warp\n", n_mismatches);
+}
+
 int main(int, char const* [])
 {
     // test_constructors(54, 23, 2.4);
     // test_clear<float>();
     // test_resize<uint16_t>(213, 13);
     // test_assign(14, 2, 2.3);
+    test_conservative_resize<float>(7, 12);
+    test_text_format();
+    test_binary_round_trip(BinaryPrecision::FLOAT32);
+    test_binary_round_trip(BinaryPrecision::FLOAT16);
+    test_half_conversions();
+    test_packet_warp<float>(true);
+    test_packet_warp<float>(false);
+    test_packet_warp<powitacq::Half>(false);
     // test_iterator();
 
     // powitacq::Vector3f wi{0.0f, 0.0f, 1.0f};
@@ -153,5 +449,5 @@ int main(int, char const* [])
     }
 
 
-    return 0;
+    return s_failures == 0 ? 0 : 1;
 }